@@ -34,6 +34,66 @@ Argparse::Argparse(const int argc, const char** argv)
 			}
 			m_args["makepatch"] = std::string(argv[++i]);
 		}
+		else if (arg.compare("-cachepath") == 0) {
+			if (i == argc - 1) {
+				throw std::runtime_error("-cachepath requires a value.");
+			}
+			m_args["cachepath"] = std::string(argv[++i]);
+		}
+		else if (arg.compare("-rules") == 0) {
+			if (i == argc - 1) {
+				throw std::runtime_error("-rules requires a value.");
+			}
+			m_args["rules"] = std::string(argv[++i]);
+		}
+		else if (arg.compare("-nocache") == 0) {
+			m_args["nocache"] = std::string("true");
+		}
+		else if (arg.compare("-timings") == 0) {
+			m_args["timings"] = std::string("true");
+		}
+		else if (arg.compare("-timingsjson") == 0) {
+			if (i == argc - 1) {
+				throw std::runtime_error("-timingsjson requires a value.");
+			}
+			m_args["timingsjson"] = std::string(argv[++i]);
+		}
+		else if (arg.compare("-trace") == 0) {
+			if (i == argc - 1) {
+				throw std::runtime_error("-trace requires a value.");
+			}
+			m_args["trace"] = std::string(argv[++i]);
+		}
+		else if (arg.compare("-memory") == 0) {
+			m_args["memory"] = std::string("true");
+		}
+		else if (arg.compare("-modcost") == 0) {
+			m_args["modcost"] = std::string("true");
+		}
+		else if (arg.compare("-binarypatch") == 0) {
+			m_args["binarypatch"] = std::string("true");
+		}
+		else if (arg.compare("-watch") == 0) {
+			m_args["watch"] = std::string("true");
+		}
+		else if (arg.compare("-io") == 0) {
+			if (i == argc - 1) {
+				throw std::runtime_error("-io requires a value.");
+			}
+			m_args["io"] = std::string(argv[++i]);
+		}
+		else if (arg.compare("-threads") == 0) {
+			if (i == argc - 1) {
+				throw std::runtime_error("-threads requires a value.");
+			}
+			m_args["threads"] = std::string(argv[++i]);
+		}
+		else if (arg.compare("-parallelthreshold") == 0) {
+			if (i == argc - 1) {
+				throw std::runtime_error("-parallelthreshold requires a value.");
+			}
+			m_args["parallelthreshold"] = std::string(argv[++i]);
+		}
 		else if (arg.compare("-v") == 0) {
 			m_args["verbose"] = std::string("true");
 		}
@@ -55,6 +115,23 @@ std::string Argparse::GetString(std::string name)
 	return m_args[name];
 }
 
+int Argparse::GetInt(std::string name)
+{
+	std::string arg = m_args[name];
+	try {
+		size_t pos = 0;
+		int value = std::stoi(arg, &pos);
+		if (pos == arg.length()) {
+			return value;
+		}
+	}
+	catch (const std::exception&) {
+	}
+	std::stringstream ss;
+	ss << name << ": " << arg << " is not a valid integer argument.";
+	throw std::runtime_error(ss.str());
+}
+
 bool Argparse::GetBool(std::string name)
 {
 	std::string arg = m_args[name];
@@ -79,4 +156,17 @@ void Argparse::SetDefaults()
 	m_args[std::string("position")] = std::string("false");
 	m_args[std::string("verbose")] = std::string("false");
 	m_args[std::string("makepatch")] = std::string("");
+	m_args[std::string("cachepath")] = std::string("merge_cache");
+	m_args[std::string("rules")] = std::string("merge_rules.txt");
+	m_args[std::string("nocache")] = std::string("false");
+	m_args[std::string("binarypatch")] = std::string("false");
+	m_args[std::string("timings")] = std::string("false");
+	m_args[std::string("timingsjson")] = std::string("");
+	m_args[std::string("memory")] = std::string("false");
+	m_args[std::string("watch")] = std::string("false");
+	m_args[std::string("modcost")] = std::string("false");
+	m_args[std::string("trace")] = std::string("");
+	m_args[std::string("io")] = std::string("stdio");
+	m_args[std::string("threads")] = std::string("0");
+	m_args[std::string("parallelthreshold")] = std::string("16");
 }
@@ -0,0 +1,147 @@
+#include "MemoryReport.h"
+#include <algorithm>
+#include <iomanip>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <vector>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <fstream>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+bool MemoryReport::s_enabled = false;
+
+struct TreeMemory {
+	std::string file;
+	std::string label;
+	RBMemoryStats stats;
+};
+
+static std::mutex s_mutex;
+static std::vector<TreeMemory> s_trees;
+static size_t s_phaseRss[static_cast<int>(TimingPhase::COUNT)] = {};
+
+void MemoryReport::RecordTree(const std::string& file, const std::string& label, const RBMemoryStats& stats)
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	s_trees.push_back({ file, label, stats });
+}
+
+void MemoryReport::RecordPhase(TimingPhase phase)
+{
+	size_t rss = CurrentRss();
+	std::lock_guard<std::mutex> lock(s_mutex);
+	size_t& highWater = s_phaseRss[static_cast<int>(phase)];
+	highWater = std::max(highWater, rss);
+}
+
+void MemoryReport::Reset()
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	s_trees.clear();
+	std::fill(std::begin(s_phaseRss), std::end(s_phaseRss), 0);
+}
+
+size_t MemoryReport::CurrentRss()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return 0;
+	}
+	return counters.WorkingSetSize;
+#else
+	std::ifstream statm("/proc/self/statm");
+	size_t pages = 0;
+	size_t residentPages = 0;
+	if (!(statm >> pages >> residentPages)) {
+		return 0;
+	}
+	return residentPages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+size_t MemoryReport::PeakRss()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return 0;
+	}
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+	// kilobytes on Linux
+	return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+static std::string formatKb(size_t bytes)
+{
+	return std::to_string((bytes + 512) / 1024) + " KB";
+}
+
+static void printTree(std::ostream& out, const std::string& label, const RBMemoryStats& stats)
+{
+	out << "  " << std::left << std::setw(24) << label << std::right
+		<< std::setw(10) << stats.nodes[static_cast<int>(RBNodeType::RBNODE_LIST)]
+		<< std::setw(10) << stats.nodes[static_cast<int>(RBNodeType::RBNODE_VALUE)]
+		<< std::setw(10) << stats.nodes[static_cast<int>(RBNodeType::RBNODE_EMPTY)]
+		<< std::setw(12) << formatKb(stats.nameBytes)
+		<< std::setw(12) << formatKb(stats.valueBytes)
+		<< std::setw(10) << stats.controlBlocks
+		<< std::setw(12) << formatKb(stats.heapBytes) << std::endl;
+}
+
+void MemoryReport::PrintSummary(std::ostream& out)
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	// files merged in parallel record their trees interleaved, group them in the order the files started
+	std::map<std::string, size_t> fileOrder;
+	for (const auto& tree : s_trees) {
+		fileOrder.emplace(tree.file, fileOrder.size());
+	}
+	std::stable_sort(s_trees.begin(), s_trees.end(), [&fileOrder](const TreeMemory& a, const TreeMemory& b) { return fileOrder[a.file] < fileOrder[b.file]; });
+
+	out << std::endl << "Memory of the trees alive while merging:" << std::endl;
+	out << "  " << std::left << std::setw(24) << "" << std::right
+		<< std::setw(10) << "lists" << std::setw(10) << "values" << std::setw(10) << "empty"
+		<< std::setw(12) << "names" << std::setw(12) << "values" << std::setw(10) << "blocks" << std::setw(12) << "heap" << std::endl;
+	std::string file;
+	RBMemoryStats fileTotal;
+	for (size_t i = 0; i < s_trees.size(); ++i) {
+		const TreeMemory& tree = s_trees[i];
+		if (i == 0 || tree.file != file) {
+			file = tree.file;
+			fileTotal = RBMemoryStats();
+			out << file << std::endl;
+		}
+		printTree(out, tree.label, tree.stats);
+		fileTotal.Add(tree.stats);
+		if (i + 1 == s_trees.size() || s_trees[i + 1].file != file) {
+			printTree(out, "total", fileTotal);
+		}
+	}
+
+	out << std::endl << "Resident memory at the end of each phase, highest:" << std::endl;
+	// the peak is counted in different units than the samples on some systems, keep it consistent
+	size_t peak = PeakRss();
+	for (int i = 0; i < static_cast<int>(TimingPhase::COUNT); ++i) {
+		if (s_phaseRss[i] > 0) {
+			out << "  " << std::left << std::setw(24) << Timings::PhaseName(static_cast<TimingPhase>(i)) << std::right << std::setw(12) << formatKb(s_phaseRss[i]) << std::endl;
+			peak = std::max(peak, s_phaseRss[i]);
+		}
+	}
+	out << "Peak resident memory: " << formatKb(peak) << std::endl;
+}
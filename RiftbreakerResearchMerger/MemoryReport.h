@@ -0,0 +1,25 @@
+#pragma once
+#include <ostream>
+#include <string>
+#include "RBNode.h"
+#include "Timings.h"
+
+// Memory use of the merge, collected when -memory is set: the node and string memory of every
+// tree that is alive while a file is merged, the resident set size after each phase and the peak.
+class MemoryReport
+{
+public:
+	static void Enable() { s_enabled = true; }
+	static bool Enabled() { return s_enabled; }
+	// memory held by one tree of a file, label names the tree, e.g. the pack it was read from
+	static void RecordTree(const std::string& file, const std::string& label, const RBMemoryStats& stats);
+	// samples the resident set size at the end of a phase
+	static void RecordPhase(TimingPhase phase);
+	static void PrintSummary(std::ostream& out);
+	// forgets the recorded trees and samples, the peak of the process stays
+	static void Reset();
+	static size_t CurrentRss();
+	static size_t PeakRss();
+private:
+	static bool s_enabled;
+};
@@ -0,0 +1,92 @@
+#include "ModCostReport.h"
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+bool ModCostReport::s_enabled = false;
+
+struct PackCost {
+	ModCost total;
+	std::vector<std::string> fullFiles;
+};
+
+static std::mutex s_mutex;
+static std::map<std::string, PackCost> s_packs;
+
+void ModCost::Add(const ModCost& other)
+{
+	bytesExtracted += other.bytesExtracted;
+	nodesParsed += other.nodesParsed;
+	nodesRemoved += other.nodesRemoved;
+	nodesMerged += other.nodesMerged;
+	seconds += other.seconds;
+	patchFiles += other.patchFiles;
+	fullFiles += other.fullFiles;
+	cachedFiles += other.cachedFiles;
+}
+
+void ModCostReport::Record(const std::string& pack, const std::string& file, const ModCost& cost)
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	PackCost& packCost = s_packs[pack];
+	packCost.total.Add(cost);
+	if (cost.fullFiles > 0) {
+		packCost.fullFiles.push_back(file);
+	}
+}
+
+void ModCostReport::Reset()
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	s_packs.clear();
+}
+
+void ModCostReport::PrintSummary(std::ostream& out)
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	std::vector<std::pair<std::string, const PackCost*>> ranked;
+	for (const auto& [pack, cost] : s_packs) {
+		ranked.emplace_back(pack, &cost);
+	}
+	std::stable_sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) { return a.second->total.seconds > b.second->total.seconds; });
+
+	out << std::endl << "Cost per mod pack, slowest first:" << std::endl;
+	out << "  " << std::left << std::setw(32) << "" << std::right
+		<< std::setw(10) << "ms" << std::setw(12) << "extracted" << std::setw(10) << "parsed"
+		<< std::setw(10) << "removed" << std::setw(10) << "merged" << std::setw(9) << "patches" << std::setw(7) << "full" << std::endl;
+	for (const auto& [pack, cost] : ranked) {
+		const ModCost& total = cost->total;
+		std::stringstream ms;
+		ms << std::fixed << std::setprecision(1) << total.seconds * 1000.0;
+		out << "  " << std::left << std::setw(32) << pack << std::right
+			<< std::setw(10) << ms.str()
+			<< std::setw(12) << std::to_string((total.bytesExtracted + 512) / 1024) + " KB"
+			<< std::setw(10) << total.nodesParsed
+			<< std::setw(10) << total.nodesRemoved
+			<< std::setw(10) << total.nodesMerged
+			<< std::setw(9) << total.patchFiles
+			<< std::setw(7) << total.fullFiles << std::endl;
+	}
+
+	bool header = false;
+	for (const auto& [pack, cost] : ranked) {
+		if (cost->fullFiles.empty()) {
+			continue;
+		}
+		if (!header) {
+			out << std::endl << "Mod packs that ship full files instead of .merge patches, these have to be diffed against the base:" << std::endl;
+			header = true;
+		}
+		out << "  " << pack << ":";
+		for (const auto& file : cost->fullFiles) {
+			out << " " << file;
+		}
+		if (cost->total.cachedFiles > 0) {
+			out << " (" << cost->total.cachedFiles << " from the patch cache)";
+		}
+		out << std::endl;
+	}
+}
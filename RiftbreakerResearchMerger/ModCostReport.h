@@ -0,0 +1,34 @@
+#pragma once
+#include <ostream>
+#include <string>
+
+// Work done for one mod pack while merging one file.
+struct ModCost
+{
+	size_t bytesExtracted = 0;
+	size_t nodesParsed = 0;
+	size_t nodesRemoved = 0;
+	// nodes of the patch that the merge adds to or merges into the base
+	size_t nodesMerged = 0;
+	double seconds = 0.0;
+	size_t patchFiles = 0;
+	size_t fullFiles = 0;
+	// full files whose patch was read from the patch cache
+	size_t cachedFiles = 0;
+	void Add(const ModCost& other);
+};
+
+// Cost of every mod pack summed over all merged files, collected when -modcost is set.
+// Mod packs are ranked by time, packs that ship full files instead of patches are flagged.
+class ModCostReport
+{
+public:
+	static void Enable() { s_enabled = true; }
+	static bool Enabled() { return s_enabled; }
+	static void Record(const std::string& pack, const std::string& file, const ModCost& cost);
+	static void PrintSummary(std::ostream& out);
+	// forgets the recorded costs, -watch reports every merge on its own
+	static void Reset();
+private:
+	static bool s_enabled;
+};
@@ -0,0 +1,80 @@
+#include "PackWatcher.h"
+#include <stdexcept>
+#include <sstream>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+PackWatcher::PackWatcher(const std::filesystem::path& path)
+{
+#ifdef _WIN32
+	m_handle = FindFirstChangeNotificationW(path.wstring().c_str(), FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+	if (m_handle == INVALID_HANDLE_VALUE) {
+		std::stringstream ss;
+		ss << "Failed to watch " << path << ", error " << GetLastError() << ".";
+		throw std::runtime_error(ss.str());
+	}
+#else
+	m_fd = inotify_init1(IN_CLOEXEC);
+	m_watch = m_fd < 0 ? -1 : inotify_add_watch(m_fd, path.string().c_str(), IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+	if (m_watch < 0) {
+		int error = errno;
+		if (m_fd >= 0) {
+			close(m_fd);
+		}
+		std::stringstream ss;
+		ss << "Failed to watch " << path << ", error " << error << ".";
+		throw std::runtime_error(ss.str());
+	}
+#endif
+}
+
+PackWatcher::~PackWatcher()
+{
+#ifdef _WIN32
+	FindCloseChangeNotification(m_handle);
+#else
+	close(m_fd);
+#endif
+}
+
+void PackWatcher::Wait()
+{
+	while (!WaitFor(std::chrono::milliseconds(-1))) {
+	}
+}
+
+void PackWatcher::WaitQuiet(std::chrono::milliseconds quiet)
+{
+	while (WaitFor(quiet)) {
+	}
+}
+
+bool PackWatcher::WaitFor(std::chrono::milliseconds timeout)
+{
+#ifdef _WIN32
+	DWORD status = WaitForSingleObject(m_handle, timeout.count() < 0 ? INFINITE : static_cast<DWORD>(timeout.count()));
+	if (status != WAIT_OBJECT_0) {
+		return false;
+	}
+	// rearm for the next change
+	FindNextChangeNotification(m_handle);
+	return true;
+#else
+	pollfd fd{ m_fd, POLLIN, 0 };
+	if (poll(&fd, 1, static_cast<int>(timeout.count())) <= 0) {
+		return false;
+	}
+	// the events only wake us up, the caller compares the packs
+	alignas(inotify_event) char buffer[4096];
+	read(m_fd, buffer, sizeof(buffer));
+	return true;
+#endif
+}
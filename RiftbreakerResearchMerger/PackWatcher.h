@@ -0,0 +1,27 @@
+#pragma once
+#include <chrono>
+#include <filesystem>
+
+// Waits for changes of the files in a folder, inotify on Linux and a change notification on Windows.
+class PackWatcher
+{
+public:
+	// throws if the folder can not be watched
+	PackWatcher(const std::filesystem::path& path);
+	~PackWatcher();
+	PackWatcher(const PackWatcher&) = delete;
+	PackWatcher& operator=(const PackWatcher&) = delete;
+	// blocks until a file in the folder was created, written, renamed or removed
+	void Wait();
+	// blocks until there was no change for the quiet time, packs are often written in several steps
+	void WaitQuiet(std::chrono::milliseconds quiet);
+private:
+	// false if there was no change within the timeout
+	bool WaitFor(std::chrono::milliseconds timeout);
+#ifdef _WIN32
+	void* m_handle;
+#else
+	int m_fd;
+	int m_watch;
+#endif
+};
@@ -0,0 +1,334 @@
+#include "RBBinaryPatch.h"
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+static const char binaryPatchMagic[4] = { 'R', 'B', 'M', 'B' };
+
+enum class BinaryValueType : uint8_t {
+	STRING = 0,
+	INTEGER = 1,
+};
+
+class BinaryPatchWriter
+{
+public:
+	BinaryPatchWriter(std::shared_ptr<RBMergeRules> rules) : m_rules(rules) {}
+	void WriteNodes(RBNodeList& list);
+	std::string Finish(uint32_t textCrc32, uint64_t textSize);
+private:
+	void WriteNode(std::shared_ptr<RBNode> node);
+	void WriteListKeys(RBNodeList& list);
+	void WriteVarint(uint64_t value);
+	void WriteString(const std::string& value);
+	void WriteRaw(const void* data, size_t length) { m_body.append(static_cast<const char*>(data), length); }
+	uint64_t Intern(const std::string& value);
+
+	std::shared_ptr<RBMergeRules> m_rules;
+	std::string m_body;
+	std::vector<const std::string*> m_strings;
+	std::unordered_map<std::string, uint64_t> m_stringIndexes;
+};
+
+class BinaryPatchReader
+{
+public:
+	BinaryPatchReader(const char* data, size_t size) : m_data(data), m_size(size), m_pos(0) {}
+	bool ReadHeader(uint32_t textCrc32, uint64_t textSize, uint64_t rulesFingerprint);
+	void ReadStrings();
+	void ReadNodes(RBNodeList& list);
+	bool AtEnd() const { return m_pos == m_size; }
+private:
+	std::shared_ptr<RBNode> ReadNode();
+	uint8_t ReadByte();
+	uint64_t ReadVarint();
+	void ReadRaw(void* data, size_t length);
+	const std::string& ReadStringRef();
+
+	const char* m_data;
+	size_t m_size;
+	size_t m_pos;
+	std::vector<std::string> m_strings;
+};
+
+// "123" style values are stored as numbers if they can be written back unchanged
+static bool parseCanonicalInteger(const std::string& value, int64_t& number)
+{
+	size_t length = value.size();
+	if (length < 3 || value[0] != '"' || value[length - 1] != '"') {
+		return false;
+	}
+	size_t start = value[1] == '-' ? 2 : 1;
+	size_t digits = length - 1 - start;
+	if (digits == 0 || digits > 18 || (value[start] == '0' && (digits > 1 || start == 2))) {
+		return false;
+	}
+	int64_t result = 0;
+	for (size_t i = start; i < length - 1; ++i) {
+		if (value[i] < '0' || value[i] > '9') {
+			return false;
+		}
+		result = result * 10 + (value[i] - '0');
+	}
+	number = start == 2 ? -result : result;
+	return true;
+}
+
+static uint64_t zigzagEncode(int64_t value)
+{
+	return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+static int64_t zigzagDecode(uint64_t value)
+{
+	return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+void BinaryPatchWriter::WriteNodes(RBNodeList& list)
+{
+	auto nodes = list.GetNodes();
+	WriteVarint(nodes.size());
+	for (const auto& node : nodes) {
+		WriteNode(node);
+	}
+}
+
+void BinaryPatchWriter::WriteNode(std::shared_ptr<RBNode> node)
+{
+	RBNodeType type = node->GetType();
+	m_body.push_back(static_cast<char>(type));
+	WriteVarint(Intern(node->GetName()));
+	if (type == RBNodeType::RBNODE_VALUE) {
+		std::string value = std::static_pointer_cast<RBNodeValue>(node)->GetValue();
+		int64_t number;
+		if (parseCanonicalInteger(value, number)) {
+			m_body.push_back(static_cast<char>(BinaryValueType::INTEGER));
+			WriteVarint(zigzagEncode(number));
+		}
+		else {
+			m_body.push_back(static_cast<char>(BinaryValueType::STRING));
+			WriteVarint(Intern(value));
+		}
+	}
+	else if (type == RBNodeType::RBNODE_LIST) {
+		RBNodeList& list = *std::static_pointer_cast<RBNodeList>(node);
+		WriteNodes(list);
+		WriteListKeys(list);
+	}
+}
+
+void BinaryPatchWriter::WriteListKeys(RBNodeList& list)
+{
+	// only lists merged by key get an index
+	std::string elementName = list.ListName();
+	std::string keyName;
+	if (!elementName.empty() && m_rules->Get(list.GetName())->mergeType == RBMergeType::RBMERGE_LIST && list.IsList()) {
+		keyName = m_rules->Get(elementName)->listKey;
+	}
+	std::vector<std::string> keys;
+	if (!keyName.empty()) {
+		try {
+			keys = list.ListKeys(keyName);
+		}
+		catch (const std::exception&) {
+			// invalid lists are reported when merging, they just don't get an index
+			keyName.clear();
+		}
+	}
+	if (keyName.empty()) {
+		m_body.push_back(0);
+		return;
+	}
+	m_body.push_back(1);
+	WriteVarint(Intern(keyName));
+	for (const auto& key : keys) {
+		WriteVarint(Intern(key));
+	}
+}
+
+void BinaryPatchWriter::WriteVarint(uint64_t value)
+{
+	while (value >= 0x80) {
+		m_body.push_back(static_cast<char>((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	m_body.push_back(static_cast<char>(value));
+}
+
+void BinaryPatchWriter::WriteString(const std::string& value)
+{
+	WriteVarint(value.size());
+	m_body.append(value);
+}
+
+uint64_t BinaryPatchWriter::Intern(const std::string& value)
+{
+	auto inserted = m_stringIndexes.emplace(value, m_strings.size());
+	if (inserted.second) {
+		m_strings.push_back(&inserted.first->first);
+	}
+	return inserted.first->second;
+}
+
+std::string BinaryPatchWriter::Finish(uint32_t textCrc32, uint64_t textSize)
+{
+	std::string body;
+	body.swap(m_body);
+
+	uint64_t rulesFingerprint = m_rules->Fingerprint();
+	WriteRaw(binaryPatchMagic, sizeof(binaryPatchMagic));
+	WriteVarint(binaryPatchVersion);
+	WriteVarint(textCrc32);
+	WriteVarint(textSize);
+	WriteRaw(&rulesFingerprint, sizeof(rulesFingerprint));
+	WriteVarint(m_strings.size());
+	for (const std::string* value : m_strings) {
+		WriteString(*value);
+	}
+	m_body.append(body);
+
+	std::string result;
+	result.swap(m_body);
+	return result;
+}
+
+bool BinaryPatchReader::ReadHeader(uint32_t textCrc32, uint64_t textSize, uint64_t rulesFingerprint)
+{
+	char magic[sizeof(binaryPatchMagic)];
+	ReadRaw(magic, sizeof(magic));
+	if (memcmp(magic, binaryPatchMagic, sizeof(magic)) != 0) {
+		throw std::runtime_error("Not a binary patch file.");
+	}
+	if (ReadVarint() != binaryPatchVersion) {
+		return false;
+	}
+	uint64_t fileTextCrc32 = ReadVarint();
+	uint64_t fileTextSize = ReadVarint();
+	uint64_t fileRulesFingerprint;
+	ReadRaw(&fileRulesFingerprint, sizeof(fileRulesFingerprint));
+	return fileTextCrc32 == textCrc32 && fileTextSize == textSize && fileRulesFingerprint == rulesFingerprint;
+}
+
+void BinaryPatchReader::ReadStrings()
+{
+	uint64_t count = ReadVarint();
+	if (count > m_size - m_pos) {
+		throw std::runtime_error("Invalid string table size in binary patch.");
+	}
+	m_strings.resize(count);
+	for (auto& value : m_strings) {
+		uint64_t length = ReadVarint();
+		if (length > m_size - m_pos) {
+			throw std::runtime_error("Invalid string length in binary patch.");
+		}
+		value.assign(m_data + m_pos, length);
+		m_pos += length;
+	}
+}
+
+void BinaryPatchReader::ReadNodes(RBNodeList& list)
+{
+	uint64_t count = ReadVarint();
+	if (count > m_size - m_pos) {
+		throw std::runtime_error("Invalid node count in binary patch.");
+	}
+	for (uint64_t i = 0; i < count; ++i) {
+		list.AddNode(ReadNode());
+	}
+}
+
+std::shared_ptr<RBNode> BinaryPatchReader::ReadNode()
+{
+	uint8_t type = ReadByte();
+	const std::string& name = ReadStringRef();
+	if (type == static_cast<uint8_t>(RBNodeType::RBNODE_EMPTY)) {
+		return std::make_shared<RBNodeEmpty>(name);
+	}
+	if (type == static_cast<uint8_t>(RBNodeType::RBNODE_VALUE)) {
+		uint8_t valueType = ReadByte();
+		if (valueType == static_cast<uint8_t>(BinaryValueType::INTEGER)) {
+			return std::make_shared<RBNodeValue>(name, "\"" + std::to_string(zigzagDecode(ReadVarint())) + "\"");
+		}
+		if (valueType == static_cast<uint8_t>(BinaryValueType::STRING)) {
+			return std::make_shared<RBNodeValue>(name, ReadStringRef());
+		}
+	}
+	else if (type == static_cast<uint8_t>(RBNodeType::RBNODE_LIST)) {
+		auto list = std::make_shared<RBNodeList>(name);
+		ReadNodes(*list);
+		if (ReadByte() != 0) {
+			const std::string& keyName = ReadStringRef();
+			std::vector<std::string> keys(list->Size());
+			for (auto& key : keys) {
+				key = ReadStringRef();
+			}
+			list->SetListKeys(keyName, std::move(keys));
+		}
+		return list;
+	}
+	std::stringstream ss;
+	ss << "Invalid node type " << static_cast<int>(type) << " in binary patch.";
+	throw std::runtime_error(ss.str());
+}
+
+uint8_t BinaryPatchReader::ReadByte()
+{
+	if (m_pos >= m_size) {
+		throw std::runtime_error("Unexpected end of binary patch.");
+	}
+	return static_cast<uint8_t>(m_data[m_pos++]);
+}
+
+uint64_t BinaryPatchReader::ReadVarint()
+{
+	uint64_t value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		uint8_t byte = ReadByte();
+		value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			return value;
+		}
+	}
+	throw std::runtime_error("Invalid number in binary patch.");
+}
+
+void BinaryPatchReader::ReadRaw(void* data, size_t length)
+{
+	if (length > m_size - m_pos) {
+		throw std::runtime_error("Unexpected end of binary patch.");
+	}
+	memcpy(data, m_data + m_pos, length);
+	m_pos += length;
+}
+
+const std::string& BinaryPatchReader::ReadStringRef()
+{
+	uint64_t index = ReadVarint();
+	if (index >= m_strings.size()) {
+		throw std::runtime_error("Invalid string index in binary patch.");
+	}
+	return m_strings[index];
+}
+
+std::string writeBinaryPatch(std::shared_ptr<RBFile> file, uint32_t textCrc32, uint64_t textSize, std::shared_ptr<RBMergeRules> rules)
+{
+	BinaryPatchWriter writer(rules);
+	writer.WriteNodes(*file->GetRoot());
+	return writer.Finish(textCrc32, textSize);
+}
+
+std::shared_ptr<RBFile> readBinaryPatch(const char* data, size_t size, uint32_t textCrc32, uint64_t textSize, std::shared_ptr<RBMergeRules> rules)
+{
+	BinaryPatchReader reader(data, size);
+	if (!reader.ReadHeader(textCrc32, textSize, rules->Fingerprint())) {
+		return nullptr;
+	}
+	reader.ReadStrings();
+	auto root = std::make_shared<RBNodeList>(std::string("ROOT"));
+	reader.ReadNodes(*root);
+	if (!reader.AtEnd()) {
+		throw std::runtime_error("Unexpected data at the end of binary patch.");
+	}
+	return std::make_shared<RBFile>(root);
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "RBFile.h"
+#include "RBMergeRules.h"
+
+// Binary form of a .merge patch file, stored next to it as .merge.bin.
+// Names and values are interned in a string table, integer values are stored as numbers and
+// keyed lists carry the keys of their entries so merging does not have to look them up.
+// The header records the text patch and the rules it was written for, any mismatch makes it stale.
+const uint32_t binaryPatchVersion = 1;
+
+std::string writeBinaryPatch(std::shared_ptr<RBFile> file, uint32_t textCrc32, uint64_t textSize, std::shared_ptr<RBMergeRules> rules);
+// returns nullptr if the patch is stale, throws if it is malformed
+std::shared_ptr<RBFile> readBinaryPatch(const char* data, size_t size, uint32_t textCrc32, uint64_t textSize, std::shared_ptr<RBMergeRules> rules);
@@ -0,0 +1,82 @@
+#include "RBBufferPool.h"
+
+RBBufferPool::Buffer::Buffer(Buffer&& other) noexcept
+	: m_pool(other.m_pool), m_storage(std::move(other.m_storage)), m_sizeClass(other.m_sizeClass), m_size(other.m_size)
+{
+	other.m_pool = nullptr;
+	other.m_size = 0;
+}
+
+RBBufferPool::Buffer& RBBufferPool::Buffer::operator=(Buffer&& other) noexcept
+{
+	if (this != &other) {
+		Release();
+		m_pool = other.m_pool;
+		m_storage = std::move(other.m_storage);
+		m_sizeClass = other.m_sizeClass;
+		m_size = other.m_size;
+		other.m_pool = nullptr;
+		other.m_size = 0;
+	}
+	return *this;
+}
+
+RBBufferPool::Buffer::~Buffer()
+{
+	Release();
+}
+
+void RBBufferPool::Buffer::Release()
+{
+	if (m_pool && m_storage) {
+		m_pool->Release(std::move(m_storage), m_sizeClass);
+	}
+	m_storage.reset();
+	m_pool = nullptr;
+	m_size = 0;
+}
+
+RBBufferPool& RBBufferPool::Shared()
+{
+	static RBBufferPool pool;
+	return pool;
+}
+
+RBBufferPool::Buffer RBBufferPool::Acquire(size_t size)
+{
+	size_t sizeClass = 0;
+	while (sizeClass < numClasses && (size_t(1) << (minClassBits + sizeClass)) < size) {
+		++sizeClass;
+	}
+	Buffer buffer;
+	buffer.m_size = size;
+	if (sizeClass == numClasses) {
+		// too large to be kept, allocated for this entry only
+		buffer.m_storage.reset(new char[size]);
+		return buffer;
+	}
+	buffer.m_pool = this;
+	buffer.m_sizeClass = sizeClass;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::vector<std::unique_ptr<char[]>>& free = m_free[sizeClass];
+		if (!free.empty()) {
+			buffer.m_storage = std::move(free.back());
+			free.pop_back();
+			m_cachedBytes -= size_t(1) << (minClassBits + sizeClass);
+			return buffer;
+		}
+	}
+	buffer.m_storage.reset(new char[size_t(1) << (minClassBits + sizeClass)]);
+	return buffer;
+}
+
+void RBBufferPool::Release(std::unique_ptr<char[]> storage, size_t sizeClass)
+{
+	size_t capacity = size_t(1) << (minClassBits + sizeClass);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_cachedBytes + capacity <= maxCachedBytes) {
+		m_free[sizeClass].push_back(std::move(storage));
+		m_cachedBytes += capacity;
+	}
+}
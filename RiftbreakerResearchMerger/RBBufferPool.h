@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Buffers for extracted pack entries, shared by all threads of a run. Sizes are rounded up to a power of two
+// so a released buffer serves any later entry of its size class instead of allocating every entry anew.
+class RBBufferPool
+{
+public:
+	// storage taken from the pool, given back when the buffer is destroyed
+	class Buffer
+	{
+	public:
+		Buffer() = default;
+		Buffer(Buffer&& other) noexcept;
+		Buffer& operator=(Buffer&& other) noexcept;
+		~Buffer();
+		char* Data() { return m_storage.get(); }
+		const char* Data() const { return m_storage.get(); }
+		size_t Size() const { return m_size; }
+	private:
+		friend class RBBufferPool;
+		void Release();
+
+		RBBufferPool* m_pool = nullptr;
+		std::unique_ptr<char[]> m_storage;
+		size_t m_sizeClass = 0;
+		size_t m_size = 0;
+	};
+
+	static RBBufferPool& Shared();
+	// buffer of size bytes with undefined content
+	Buffer Acquire(size_t size);
+private:
+	// smallest class, larger ones double up to the largest pooled class
+	static const size_t minClassBits = 16;
+	static const size_t numClasses = 11;
+	// bytes kept in released buffers, buffers released beyond it are freed
+	static const size_t maxCachedBytes = 64 * 1024 * 1024;
+
+	void Release(std::unique_ptr<char[]> storage, size_t sizeClass);
+
+	std::mutex m_mutex;
+	std::vector<std::unique_ptr<char[]>> m_free[numClasses];
+	size_t m_cachedBytes = 0;
+};
@@ -0,0 +1,159 @@
+#include "RBCrc32.h"
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define RB_CRC32_CLMUL 1
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define RB_TARGET_CLMUL
+#else
+#include <cpuid.h>
+#define RB_TARGET_CLMUL __attribute__((target("sse2,pclmul")))
+#endif
+#endif
+
+// reflected polynomial of the zip CRC-32
+static const uint32_t crcPolynomial = 0xEDB88320;
+
+// tables[k][b] is the CRC of byte b followed by k zero bytes
+struct SliceTables {
+	uint32_t tables[8][256];
+	SliceTables() {
+		for (uint32_t b = 0; b < 256; ++b) {
+			uint32_t crc = b;
+			for (int bit = 0; bit < 8; ++bit) {
+				crc = crc & 1 ? (crc >> 1) ^ crcPolynomial : crc >> 1;
+			}
+			tables[0][b] = crc;
+		}
+		for (uint32_t b = 0; b < 256; ++b) {
+			for (int k = 1; k < 8; ++k) {
+				tables[k][b] = (tables[k - 1][b] >> 8) ^ tables[0][tables[k - 1][b] & 0xFF];
+			}
+		}
+	}
+};
+
+static const SliceTables& sliceTables()
+{
+	static const SliceTables tables;
+	return tables;
+}
+
+static inline uint64_t loadLittleEndian64(const unsigned char* data)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	uint64_t value = 0;
+	for (int i = 7; i >= 0; --i) {
+		value = value << 8 | data[i];
+	}
+	return value;
+#else
+	uint64_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+#endif
+}
+
+// works on the inverted CRC like the folding below
+static uint32_t sliceBy8(uint32_t crc, const unsigned char* data, size_t length)
+{
+	const uint32_t (*t)[256] = sliceTables().tables;
+	for (; length >= 8; data += 8, length -= 8) {
+		uint64_t word = loadLittleEndian64(data) ^ crc;
+		crc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^ t[5][(word >> 16) & 0xFF] ^ t[4][(word >> 24) & 0xFF]
+			^ t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^ t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+	}
+	for (; length > 0; ++data, --length) {
+		crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xFF];
+	}
+	return crc;
+}
+
+#ifdef RB_CRC32_CLMUL
+// shorter inputs are not worth setting up the folding for
+static const size_t clmulMinLength = 64;
+
+static bool hasClmul()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 1)) != 0;
+#else
+	unsigned eax, ebx, ecx, edx;
+	return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_PCLMUL) != 0;
+#endif
+}
+
+RB_TARGET_CLMUL static inline __m128i fold(__m128i value, __m128i constants, __m128i next)
+{
+	__m128i low = _mm_clmulepi64_si128(value, constants, 0x00);
+	__m128i high = _mm_clmulepi64_si128(value, constants, 0x11);
+	return _mm_xor_si128(_mm_xor_si128(low, high), next);
+}
+
+// Folds a multiple of 16 bytes, at least 64, into the inverted CRC as in Intel's "Fast CRC Computation for
+// Generic Polynomials Using PCLMULQDQ Instruction": four lanes fold 64 bytes per round, then are folded into one
+// lane, reduced to 64 bits and brought down to 32 bits with a Barrett reduction.
+RB_TARGET_CLMUL static uint32_t foldClmul(uint32_t crc, const unsigned char* data, size_t length)
+{
+	// x^(4*128+32) and x^(4*128-32), x^(128+32) and x^(128-32), x^64 modulo the polynomial, bit reflected
+	const __m128i fold4 = _mm_set_epi64x(0x01C6E41596, 0x0154442BD4);
+	const __m128i fold1 = _mm_set_epi64x(0x00CCAA009E, 0x01751997D0);
+	const __m128i reduce64 = _mm_set_epi64x(0, 0x0163CD6124);
+	// the polynomial and its Barrett constant
+	const __m128i barrett = _mm_set_epi64x(0x01F7011641, 0x01DB710641);
+	const __m128i low32 = _mm_set_epi32(0, -1, 0, -1);
+
+	__m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)data), _mm_cvtsi32_si128((int)crc));
+	__m128i x2 = _mm_loadu_si128((const __m128i*)(data + 16));
+	__m128i x3 = _mm_loadu_si128((const __m128i*)(data + 32));
+	__m128i x4 = _mm_loadu_si128((const __m128i*)(data + 48));
+	data += 64;
+	length -= 64;
+	for (; length >= 64; data += 64, length -= 64) {
+		x1 = fold(x1, fold4, _mm_loadu_si128((const __m128i*)data));
+		x2 = fold(x2, fold4, _mm_loadu_si128((const __m128i*)(data + 16)));
+		x3 = fold(x3, fold4, _mm_loadu_si128((const __m128i*)(data + 32)));
+		x4 = fold(x4, fold4, _mm_loadu_si128((const __m128i*)(data + 48)));
+	}
+	x1 = fold(x1, fold1, x2);
+	x1 = fold(x1, fold1, x3);
+	x1 = fold(x1, fold1, x4);
+	for (; length >= 16; data += 16, length -= 16) {
+		x1 = fold(x1, fold1, _mm_loadu_si128((const __m128i*)data));
+	}
+
+	// 128 to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, fold1, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), reduce64, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// 64 to 32 bits
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), barrett, 0x10);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, low32), barrett, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif
+
+uint32_t zipCrc32(uint32_t crc, const void* data, size_t length)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	crc = ~crc;
+#ifdef RB_CRC32_CLMUL
+	static const bool useClmul = hasClmul();
+	if (useClmul && length >= clmulMinLength) {
+		size_t folded = length & ~static_cast<size_t>(15);
+		crc = foldClmul(crc, bytes, folded);
+		bytes += folded;
+		length -= folded;
+	}
+#endif
+	return ~sliceBy8(crc, bytes, length);
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32 of zip entries, continued from crc like mz_crc32 and started with MZ_CRC32_INIT (0).
+// Folds 64 bytes at a time with carry-less multiplication on CPUs with PCLMULQDQ,
+// other CPUs and the remaining bytes use slicing-by-8 tables.
+uint32_t zipCrc32(uint32_t crc, const void* data, size_t length);
@@ -0,0 +1,45 @@
+#include "RBDeflateStream.h"
+#include <stdexcept>
+#include "RBCrc32.h"
+
+RBDeflateStream::RBDeflateStream(int level) : m_uncompressedSize(0), m_crc32(MZ_CRC32_INIT)
+{
+	m_compressor = tdefl_compressor_alloc();
+	if (!m_compressor) {
+		throw std::runtime_error("Failed to allocate deflate compressor.");
+	}
+	// same parameters as the zip writer uses for its own entries
+	if (tdefl_init(m_compressor, PutBuffer, this, tdefl_create_comp_flags_from_zip_params(level, -15, MZ_DEFAULT_STRATEGY)) != TDEFL_STATUS_OKAY) {
+		tdefl_compressor_free(m_compressor);
+		throw std::runtime_error("Failed to initialize deflate compressor.");
+	}
+}
+
+RBDeflateStream::~RBDeflateStream()
+{
+	tdefl_compressor_free(m_compressor);
+}
+
+void RBDeflateStream::Write(const char* data, size_t length)
+{
+	m_crc32 = zipCrc32(m_crc32, data, length);
+	m_uncompressedSize += length;
+	if (tdefl_compress_buffer(m_compressor, data, length, TDEFL_NO_FLUSH) != TDEFL_STATUS_OKAY) {
+		throw std::runtime_error("Failed to compress data.");
+	}
+}
+
+void RBDeflateStream::Finish()
+{
+	if (tdefl_compress_buffer(m_compressor, nullptr, 0, TDEFL_FINISH) != TDEFL_STATUS_DONE) {
+		throw std::runtime_error("Failed to finish compressed data.");
+	}
+}
+
+mz_bool RBDeflateStream::PutBuffer(const void* buffer, int length, void* user)
+{
+	RBDeflateStream* stream = static_cast<RBDeflateStream*>(user);
+	const unsigned char* bytes = static_cast<const unsigned char*>(buffer);
+	stream->m_compressed.insert(stream->m_compressed.end(), bytes, bytes + length);
+	return MZ_TRUE;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "miniz/miniz.h"
+
+// Raw deflate compressor fed in chunks, as written into zip entries.
+// Keeps the CRC-32 and size of the uncompressed input so the whole input never has to be in memory.
+class RBDeflateStream
+{
+public:
+	RBDeflateStream(int level);
+	RBDeflateStream(const RBDeflateStream&) = delete;
+	RBDeflateStream& operator=(const RBDeflateStream&) = delete;
+	~RBDeflateStream();
+	void Write(const char* data, size_t length);
+	void Finish();
+	const unsigned char* Data() const { return m_compressed.data(); }
+	size_t Size() const { return m_compressed.size(); }
+	uint64_t UncompressedSize() const { return m_uncompressedSize; }
+	uint32_t Crc32() const { return m_crc32; }
+private:
+	static mz_bool PutBuffer(const void* buffer, int length, void* user);
+	tdefl_compressor* m_compressor;
+	std::vector<unsigned char> m_compressed;
+	uint64_t m_uncompressedSize;
+	uint32_t m_crc32;
+};
@@ -30,16 +30,57 @@ void RBFile::Merge(std::shared_ptr<RBFile> other, std::shared_ptr<RBMergeRules>
 	m_root->Merge(other->m_root, rules);
 }
 
+void RBFile::MergeAll(const std::vector<std::shared_ptr<RBFile>>& others, std::shared_ptr<RBMergeRules> rules)
+{
+	std::vector<std::shared_ptr<RBNode>> otherRoots;
+	for (const auto& other : others) {
+		otherRoots.push_back(other->m_root);
+	}
+	m_root->MergeAll(otherRoots, rules);
+}
+
 void RBFile::Serialize(std::ostream& out)
+{
+	RBWriteBuffer buffer;
+	buffer.Reserve(GetSerializedSize());
+	Serialize(buffer);
+	out.write(buffer.Data(), buffer.Size());
+}
+
+void RBFile::Serialize(RBWriteBuffer& out)
 {
 	for (const auto& node : m_root->GetNodes()) {
 		node->Serialize(out, 0);
 	}
 }
 
-void RBFile::RemoveEqual(std::shared_ptr<RBFile> other, std::shared_ptr<RBMergeRules> rules)
+size_t RBFile::GetSerializedSize() const
+{
+	// the root itself is not written, only its nodes
+	size_t size = 0;
+	for (const auto& node : m_root->GetNodes()) {
+		size += node->GetSerializedSize().bytes;
+	}
+	return size;
+}
+
+RBMemoryStats RBFile::GetMemoryStats() const
+{
+	RBMemoryStats stats;
+	m_root->CollectMemoryStats(stats);
+	return stats;
+}
+
+std::map<std::string, size_t> RBFile::RemoveEqual(std::shared_ptr<RBFile> other, std::shared_ptr<RBMergeRules> rules)
+{
+	std::map<std::string, size_t> removedCounts;
+	m_root->RemoveEqual(other->m_root, rules, removedCounts);
+	return removedCounts;
+}
+
+void RBFile::UpdateHashes(std::shared_ptr<RBMergeRules> rules)
 {
-	m_root->RemoveEqual(other->m_root, rules);
+	m_root->GetHash(rules);
 }
 
 void RBFile::Parse(std::istream& in)
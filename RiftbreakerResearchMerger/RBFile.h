@@ -12,9 +12,17 @@ public:
 	RBFile(std::istream& in) { m_root = std::make_shared<RBNodeList>(std::string("ROOT"));  Parse(in); }
 	RBFile(std::shared_ptr<RBNodeList> root);
 	std::shared_ptr<RBFile> Copy();
+	std::shared_ptr<RBNodeList> GetRoot() const { return m_root; }
 	void Merge(std::shared_ptr<RBFile> other, std::shared_ptr<RBMergeRules> rules);
+	void MergeAll(const std::vector<std::shared_ptr<RBFile>>& others, std::shared_ptr<RBMergeRules> rules);
 	void Serialize(std::ostream& out);
-	void RemoveEqual(std::shared_ptr<RBFile> other, std::shared_ptr<RBMergeRules> rules);
+	void Serialize(RBWriteBuffer& out);
+	// exact number of bytes written by Serialize()
+	size_t GetSerializedSize() const;
+	// memory held by the tree, including the root
+	RBMemoryStats GetMemoryStats() const;
+	std::map<std::string, size_t> RemoveEqual(std::shared_ptr<RBFile> other, std::shared_ptr<RBMergeRules> rules);
+	void UpdateHashes(std::shared_ptr<RBMergeRules> rules);
 private:
 	void Parse(std::istream& in);
 	std::shared_ptr<RBNodeList> m_root;
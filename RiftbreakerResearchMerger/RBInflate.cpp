@@ -0,0 +1,513 @@
+#include "RBInflate.h"
+#include <cstdint>
+#include <cstring>
+
+static const unsigned maxCodeLength = 15;
+static const unsigned numLitlenSymbols = 288;
+static const unsigned numDistSymbols = 32;
+static const unsigned numPrecodeSymbols = 19;
+// codes up to this long are decoded with one lookup, longer ones go through a subtable
+static const unsigned litlenTableBits = 11;
+static const unsigned distTableBits = 8;
+static const unsigned precodeTableBits = 7;
+// main tables and the largest possible subtables behind them
+static const size_t litlenTableSize = (1 << litlenTableBits) + numLitlenSymbols * (1 << (maxCodeLength - litlenTableBits));
+static const size_t distTableSize = (1 << distTableBits) + numDistSymbols * (1 << (maxCodeLength - distTableBits));
+static const size_t precodeTableSize = 1 << precodeTableBits;
+
+static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const uint8_t precodeOrder[numPrecodeSymbols] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// Table entries: bits 0-4 are the bits to consume, 5-7 the kind, 8-11 the extra bits of a length or
+// distance or the index bits of a subtable, 12-31 the value.
+enum EntryKind : uint32_t {
+	LITERAL = 0,
+	// two literals, the first in the low byte of the value
+	LITERAL_PAIR = 1,
+	// base of a length or distance, or a precode symbol
+	BASE = 2,
+	END_OF_BLOCK = 3,
+	SUBTABLE = 4,
+	INVALID = 5,
+};
+
+static inline uint32_t makeEntry(uint32_t kind, uint32_t extra, uint32_t value)
+{
+	return kind << 5 | extra << 8 | value << 12;
+}
+
+static inline uint32_t entryBits(uint32_t entry) { return entry & 31; }
+static inline uint32_t entryKind(uint32_t entry) { return (entry >> 5) & 7; }
+static inline uint32_t entryExtra(uint32_t entry) { return (entry >> 8) & 15; }
+static inline uint32_t entryValue(uint32_t entry) { return entry >> 12; }
+
+static uint32_t litlenEntry(unsigned symbol)
+{
+	if (symbol < 256) return makeEntry(LITERAL, 0, symbol);
+	if (symbol == 256) return makeEntry(END_OF_BLOCK, 0, 0);
+	if (symbol < 286) return makeEntry(BASE, lengthExtra[symbol - 257], lengthBase[symbol - 257]);
+	return makeEntry(INVALID, 0, 0);
+}
+
+static uint32_t distEntry(unsigned symbol)
+{
+	return symbol < 30 ? makeEntry(BASE, distExtra[symbol], distBase[symbol]) : makeEntry(INVALID, 0, 0);
+}
+
+static uint32_t precodeEntry(unsigned symbol)
+{
+	return makeEntry(BASE, 0, symbol);
+}
+
+// Fills the decode table of a canonical Huffman code given by its code lengths. Codes longer than
+// tableBits get a subtable behind the entry of their first tableBits bits, sized like in zlib to hold
+// all codes with that prefix. Unused entries of incomplete codes are INVALID. false if the code is over-subscribed.
+static bool buildTable(uint32_t* table, unsigned tableBits, size_t tableSize, const uint8_t* lengths, unsigned numSymbols, uint32_t (*symbolEntry)(unsigned))
+{
+	unsigned count[maxCodeLength + 1] = {};
+	for (unsigned symbol = 0; symbol < numSymbols; ++symbol) {
+		++count[lengths[symbol]];
+	}
+	count[0] = 0;
+	int left = 1;
+	for (unsigned length = 1; length <= maxCodeLength; ++length) {
+		left = (left << 1) - count[length];
+		if (left < 0) {
+			return false;
+		}
+	}
+	// symbols sorted by code length, in canonical code order
+	unsigned offsets[maxCodeLength + 2] = {};
+	for (unsigned length = 1; length <= maxCodeLength; ++length) {
+		offsets[length + 1] = offsets[length] + count[length];
+	}
+	uint16_t sorted[numLitlenSymbols];
+	for (unsigned symbol = 0; symbol < numSymbols; ++symbol) {
+		if (lengths[symbol]) {
+			sorted[offsets[lengths[symbol]]++] = static_cast<uint16_t>(symbol);
+		}
+	}
+	unsigned numCodes = offsets[maxCodeLength + 1];
+
+	size_t mainSize = size_t(1) << tableBits;
+	uint32_t invalid = makeEntry(INVALID, 0, 0);
+	for (size_t i = 0; i < mainSize; ++i) {
+		table[i] = invalid;
+	}
+	size_t next = mainSize;
+	uint32_t code = 0;
+	unsigned codeLength = 0;
+	uint32_t prefix = ~0u;
+	size_t subtableStart = 0;
+	unsigned subtableBits = 0;
+	for (unsigned i = 0; i < numCodes; ++i) {
+		unsigned symbol = sorted[i];
+		unsigned length = lengths[symbol];
+		code <<= length - codeLength;
+		codeLength = length;
+		// deflate sends codes starting with the most significant bit, the tables are indexed by the bits as read
+		uint32_t reversed = 0;
+		for (unsigned bit = 0; bit < length; ++bit) {
+			reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+		}
+		uint32_t entry = symbolEntry(symbol);
+		if (length <= tableBits) {
+			for (size_t j = reversed; j < mainSize; j += size_t(1) << length) {
+				table[j] = entry | length;
+			}
+		}
+		else {
+			if ((reversed & (mainSize - 1)) != prefix) {
+				prefix = reversed & (mainSize - 1);
+				subtableBits = length - tableBits;
+				int remaining = 1 << subtableBits;
+				for (unsigned l = length; l < maxCodeLength; ++l) {
+					remaining -= count[l];
+					if (remaining <= 0) {
+						break;
+					}
+					++subtableBits;
+					remaining <<= 1;
+				}
+				if (next + (size_t(1) << subtableBits) > tableSize) {
+					return false;
+				}
+				subtableStart = next;
+				next += size_t(1) << subtableBits;
+				for (size_t j = subtableStart; j < next; ++j) {
+					table[j] = invalid;
+				}
+				table[prefix] = makeEntry(SUBTABLE, subtableBits, static_cast<uint32_t>(subtableStart)) | tableBits;
+			}
+			unsigned subLength = length - tableBits;
+			for (size_t j = reversed >> tableBits; j < (size_t(1) << subtableBits); j += size_t(1) << subLength) {
+				table[subtableStart + j] = entry | subLength;
+			}
+		}
+		--count[length];
+		++code;
+	}
+	return true;
+}
+
+// Lets one lookup decode two literals whose codes fit into the main table together.
+static void addLiteralPairs(uint32_t* table)
+{
+	const size_t mainSize = size_t(1) << litlenTableBits;
+	uint32_t single[mainSize];
+	memcpy(single, table, sizeof(single));
+	for (size_t i = 0; i < mainSize; ++i) {
+		uint32_t first = single[i];
+		unsigned firstBits = entryBits(first);
+		if (entryKind(first) != LITERAL || firstBits >= litlenTableBits) {
+			continue;
+		}
+		// the bits after the first code, only valid if the second code is not longer than them
+		uint32_t second = single[i >> firstBits];
+		if (entryKind(second) == LITERAL && entryBits(second) <= litlenTableBits - firstBits) {
+			table[i] = makeEntry(LITERAL_PAIR, 0, entryValue(first) | entryValue(second) << 8) | (firstBits + entryBits(second));
+		}
+	}
+}
+
+struct FixedTables {
+	uint32_t litlen[litlenTableSize];
+	uint32_t dist[distTableSize];
+
+	FixedTables() {
+		uint8_t lengths[numLitlenSymbols];
+		memset(lengths, 8, 144);
+		memset(lengths + 144, 9, 112);
+		memset(lengths + 256, 7, 24);
+		memset(lengths + 280, 8, 8);
+		buildTable(litlen, litlenTableBits, litlenTableSize, lengths, numLitlenSymbols, litlenEntry);
+		addLiteralPairs(litlen);
+		memset(lengths, 5, numDistSymbols);
+		buildTable(dist, distTableBits, distTableSize, lengths, numDistSymbols, distEntry);
+	}
+};
+
+static const FixedTables& fixedTables()
+{
+	static const FixedTables tables;
+	return tables;
+}
+
+static inline uint64_t loadLittleEndian64(const unsigned char* data)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	uint64_t value = 0;
+	for (int i = 7; i >= 0; --i) {
+		value = value << 8 | data[i];
+	}
+	return value;
+#else
+	uint64_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+#endif
+}
+
+// Copies a match of the output, which can overlap itself. Returns the end of the match.
+static inline unsigned char* copyMatch(unsigned char* out, size_t distance, size_t length, unsigned char* outEnd)
+{
+	const unsigned char* src = out - distance;
+	unsigned char* end = out + length;
+	if (distance >= 8 && outEnd - end >= 24) {
+		// whole words, the last ones can write past the match into output that comes later.
+		// Most matches are short, the first three words are copied without a check.
+		memcpy(out, src, 8);
+		memcpy(out + 8, src + 8, 8);
+		memcpy(out + 16, src + 16, 8);
+		out += 24;
+		src += 24;
+		while (out < end) {
+			memcpy(out, src, 8);
+			out += 8;
+			src += 8;
+		}
+	}
+	else if (distance == 1) {
+		memset(out, *src, length);
+	}
+	else {
+		while (out < end) {
+			*out++ = *src++;
+		}
+	}
+	return end;
+}
+
+// Input read least significant bit first. Kept in a local copy while a block is decoded, so the
+// compiler can hold it in registers although the output is written through a char pointer.
+struct BitReader {
+	const unsigned char* in;
+	const unsigned char* inEnd;
+	uint64_t buffer = 0;
+	unsigned bitsLeft = 0;
+	// zero bytes added after the end of the input, reading them is an error found at the end of a block
+	size_t overrun = 0;
+
+	// at least 56 bits are buffered afterwards, more than the longest length and distance with their extra bits
+	inline void Refill() {
+		if (inEnd - in >= 8) {
+			buffer |= loadLittleEndian64(in) << bitsLeft;
+			in += (63 - bitsLeft) >> 3;
+			bitsLeft |= 56;
+			return;
+		}
+		while (bitsLeft <= 56) {
+			if (in < inEnd) {
+				buffer |= uint64_t(*in++) << bitsLeft;
+			}
+			else {
+				++overrun;
+			}
+			bitsLeft += 8;
+		}
+	}
+	inline uint32_t Bits(unsigned n) const { return static_cast<uint32_t>(buffer & ((uint64_t(1) << n) - 1)); }
+	inline void Consume(unsigned n) { buffer >>= n; bitsLeft -= n; }
+	inline uint32_t Decode(const uint32_t* table, unsigned tableBits) {
+		uint32_t entry = table[Bits(tableBits)];
+		if (entryKind(entry) == SUBTABLE) {
+			Consume(tableBits);
+			entry = table[entryValue(entry) + Bits(entryExtra(entry))];
+		}
+		Consume(entryBits(entry));
+		return entry;
+	}
+	// length or distance of a BASE entry, its code and extra bits consumed at once
+	inline uint32_t DecodeBase(const uint32_t* table, unsigned tableBits, uint32_t& entry) {
+		entry = table[Bits(tableBits)];
+		if (entryKind(entry) == SUBTABLE) {
+			Consume(tableBits);
+			entry = table[entryValue(entry) + Bits(entryExtra(entry))];
+		}
+		return DecodeExtra(entry);
+	}
+	inline uint32_t DecodeExtra(uint32_t entry) {
+		unsigned codeBits = entryBits(entry);
+		unsigned extraBits = entryExtra(entry);
+		uint32_t value = entryValue(entry) + static_cast<uint32_t>((buffer >> codeBits) & ((uint64_t(1) << extraBits) - 1));
+		Consume(codeBits + extraBits);
+		return value;
+	}
+};
+
+class Inflater
+{
+public:
+	Inflater(const unsigned char* source, size_t sourceSize, unsigned char* dest, size_t destSize)
+		: m_source(source), m_dest(dest), m_out(dest), m_outEnd(dest + destSize) {
+		m_bits.in = source;
+		m_bits.inEnd = source + sourceSize;
+	}
+	bool Run();
+private:
+	bool ReadStored();
+	bool ReadDynamicTables();
+	bool DecodeBlock(const uint32_t* litlen, const uint32_t* dist);
+
+	const unsigned char* m_source;
+	unsigned char* m_dest;
+	unsigned char* m_out;
+	unsigned char* m_outEnd;
+	BitReader m_bits;
+	uint32_t m_litlen[litlenTableSize];
+	uint32_t m_dist[distTableSize];
+};
+
+bool Inflater::Run()
+{
+	bool final = false;
+	while (!final) {
+		m_bits.Refill();
+		final = m_bits.Bits(1) != 0;
+		unsigned type = m_bits.Bits(3) >> 1;
+		m_bits.Consume(3);
+		bool ok;
+		if (type == 0) {
+			ok = ReadStored();
+		}
+		else if (type == 1) {
+			ok = DecodeBlock(fixedTables().litlen, fixedTables().dist);
+		}
+		else if (type == 2) {
+			ok = ReadDynamicTables() && DecodeBlock(m_litlen, m_dist);
+		}
+		else {
+			ok = false;
+		}
+		// garbage decodes as long as there is room for the output, stop once it went past the input
+		if (!ok || m_bits.overrun * 8 > m_bits.bitsLeft) {
+			return false;
+		}
+	}
+	return m_out == m_outEnd;
+}
+
+bool Inflater::ReadStored()
+{
+	// the buffered whole bytes are read again from the input
+	m_bits.Consume(m_bits.bitsLeft & 7);
+	size_t position = (m_bits.in - m_source) + m_bits.overrun - (m_bits.bitsLeft >> 3);
+	if (position > size_t(m_bits.inEnd - m_source)) {
+		return false;
+	}
+	m_bits.in = m_source + position;
+	m_bits.buffer = 0;
+	m_bits.bitsLeft = 0;
+	m_bits.overrun = 0;
+	if (m_bits.inEnd - m_bits.in < 4) {
+		return false;
+	}
+	size_t length = m_bits.in[0] | m_bits.in[1] << 8;
+	size_t inverted = m_bits.in[2] | m_bits.in[3] << 8;
+	m_bits.in += 4;
+	if (length != (~inverted & 0xFFFF) || size_t(m_bits.inEnd - m_bits.in) < length || size_t(m_outEnd - m_out) < length) {
+		return false;
+	}
+	memcpy(m_out, m_bits.in, length);
+	m_bits.in += length;
+	m_out += length;
+	return true;
+}
+
+bool Inflater::ReadDynamicTables()
+{
+	m_bits.Refill();
+	unsigned numLitlen = m_bits.Bits(5) + 257;
+	unsigned numDist = (m_bits.Bits(10) >> 5) + 1;
+	unsigned numPrecode = (m_bits.Bits(14) >> 10) + 4;
+	m_bits.Consume(14);
+	if (numLitlen > 286 || numDist > 30) {
+		return false;
+	}
+
+	uint8_t precodeLengths[numPrecodeSymbols] = {};
+	for (unsigned i = 0; i < numPrecode; ++i) {
+		if (m_bits.bitsLeft < 3) {
+			m_bits.Refill();
+		}
+		precodeLengths[precodeOrder[i]] = static_cast<uint8_t>(m_bits.Bits(3));
+		m_bits.Consume(3);
+	}
+	uint32_t precode[precodeTableSize];
+	if (!buildTable(precode, precodeTableBits, precodeTableSize, precodeLengths, numPrecodeSymbols, precodeEntry)) {
+		return false;
+	}
+
+	// code lengths of both codes, repeats can run from one into the other
+	uint8_t lengths[numLitlenSymbols + numDistSymbols] = {};
+	unsigned total = numLitlen + numDist;
+	for (unsigned n = 0; n < total;) {
+		m_bits.Refill();
+		uint32_t entry = m_bits.Decode(precode, precodeTableBits);
+		if (entryKind(entry) != BASE) {
+			return false;
+		}
+		unsigned symbol = entryValue(entry);
+		if (symbol < 16) {
+			lengths[n++] = static_cast<uint8_t>(symbol);
+			continue;
+		}
+		uint8_t value = 0;
+		unsigned repeat;
+		if (symbol == 16) {
+			if (n == 0) {
+				return false;
+			}
+			value = lengths[n - 1];
+			repeat = 3 + m_bits.Bits(2);
+			m_bits.Consume(2);
+		}
+		else if (symbol == 17) {
+			repeat = 3 + m_bits.Bits(3);
+			m_bits.Consume(3);
+		}
+		else {
+			repeat = 11 + m_bits.Bits(7);
+			m_bits.Consume(7);
+		}
+		if (repeat > total - n) {
+			return false;
+		}
+		memset(lengths + n, value, repeat);
+		n += repeat;
+	}
+	// a block without an end can not be decoded
+	if (lengths[256] == 0) {
+		return false;
+	}
+
+	uint8_t litlenLengths[numLitlenSymbols] = {};
+	uint8_t distLengths[numDistSymbols] = {};
+	memcpy(litlenLengths, lengths, numLitlen);
+	memcpy(distLengths, lengths + numLitlen, numDist);
+	if (!buildTable(m_litlen, litlenTableBits, litlenTableSize, litlenLengths, numLitlenSymbols, litlenEntry)
+		|| !buildTable(m_dist, distTableBits, distTableSize, distLengths, numDistSymbols, distEntry)) {
+		return false;
+	}
+	addLiteralPairs(m_litlen);
+	return true;
+}
+
+bool Inflater::DecodeBlock(const uint32_t* litlen, const uint32_t* dist)
+{
+	BitReader bits = m_bits;
+	unsigned char* out = m_out;
+	for (;;) {
+		bits.Refill();
+		uint32_t entry = litlen[bits.Bits(litlenTableBits)];
+		if (entryKind(entry) == SUBTABLE) {
+			bits.Consume(litlenTableBits);
+			entry = litlen[entryValue(entry) + bits.Bits(entryExtra(entry))];
+		}
+		uint32_t kind = entryKind(entry);
+		if (kind == BASE) {
+			// a match, the most common case in the text files
+			size_t length = bits.DecodeExtra(entry);
+			uint32_t distEntry;
+			size_t distance = bits.DecodeBase(dist, distTableBits, distEntry);
+			if (entryKind(distEntry) != BASE || distance > size_t(out - m_dest) || length > size_t(m_outEnd - out)) {
+				return false;
+			}
+			out = copyMatch(out, distance, length, m_outEnd);
+			continue;
+		}
+		bits.Consume(entryBits(entry));
+		if (kind == LITERAL_PAIR) {
+			if (m_outEnd - out < 2) {
+				return false;
+			}
+			out[0] = static_cast<unsigned char>(entryValue(entry));
+			out[1] = static_cast<unsigned char>(entryValue(entry) >> 8);
+			out += 2;
+			continue;
+		}
+		if (kind == LITERAL) {
+			if (out == m_outEnd) {
+				return false;
+			}
+			*out++ = static_cast<unsigned char>(entryValue(entry));
+			continue;
+		}
+		if (kind != END_OF_BLOCK) {
+			return false;
+		}
+		break;
+	}
+	m_bits = bits;
+	m_out = out;
+	return true;
+}
+
+bool inflateRaw(const unsigned char* source, size_t sourceSize, unsigned char* dest, size_t destSize)
+{
+	Inflater inflater(source, sourceSize, dest, destSize);
+	return inflater.Run();
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <cstddef>
+
+// Raw deflate decoder for zip entries, whose compressed and uncompressed sizes are known before reading.
+// The input is read 64 bits at a time, one table lookup decodes up to two literals and matches are copied
+// in words, which makes it faster than tinfl on the large text files of the packs.
+// false if the data is broken or does not inflate to exactly destSize bytes.
+bool inflateRaw(const unsigned char* source, size_t sourceSize, unsigned char* dest, size_t destSize);
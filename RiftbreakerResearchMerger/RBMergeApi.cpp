@@ -0,0 +1,162 @@
+#include "RBMergeApi.h"
+#include <stdexcept>
+#include <thread>
+#include "RBMergeSession.h"
+#include "TaskScheduler.h"
+
+struct rbmerge_session {
+	std::unique_ptr<RBMergeSession> session;
+};
+
+struct rbmerge_result {
+	RBMergeResult result;
+};
+
+static thread_local std::string t_lastError;
+
+static void setError(const char* error) {
+	t_lastError = error;
+}
+
+template <typename F>
+static auto guarded(F f, decltype(f()) failed) -> decltype(f()) {
+	try {
+		return f();
+	}
+	catch (const std::exception& e) {
+		setError(e.what());
+	}
+	catch (...) {
+		setError("Unknown error.");
+	}
+	return failed;
+}
+
+static bool validIndex(const rbmerge_result* result, size_t index, size_t size) {
+	if (!result || index >= size) {
+		setError("Invalid result or index.");
+		return false;
+	}
+	return true;
+}
+
+rbmerge_session* rbmerge_open(const char* pack_path, const char* rules_path) {
+	return guarded([&]() -> rbmerge_session* {
+		if (!pack_path) {
+			throw std::runtime_error("No pack path.");
+		}
+		std::shared_ptr<RBMergeRegistry> registry = rules_path ? RBMergeRegistry::Load(std::filesystem::u8path(rules_path)) : RBMergeRegistry::Builtin();
+		auto session = std::make_unique<rbmerge_session>();
+		session->session = std::make_unique<RBMergeSession>(std::filesystem::u8path(pack_path), registry);
+		return session.release();
+	}, nullptr);
+}
+
+void rbmerge_close(rbmerge_session* session) {
+	delete session;
+}
+
+int rbmerge_set_cache_path(rbmerge_session* session, const char* cache_path) {
+	return guarded([&]() {
+		if (!session) throw std::runtime_error("No session.");
+		session->session->SetCachePath(cache_path ? std::filesystem::u8path(cache_path) : std::filesystem::path());
+		return 0;
+	}, -1);
+}
+
+int rbmerge_set_verbose(rbmerge_session* session, int verbose) {
+	return guarded([&]() {
+		if (!session) throw std::runtime_error("No session.");
+		session->session->SetVerbose(verbose != 0);
+		return 0;
+	}, -1);
+}
+
+int rbmerge_set_keep_trees(rbmerge_session* session, int keep_trees) {
+	return guarded([&]() {
+		if (!session) throw std::runtime_error("No session.");
+		session->session->SetKeepTrees(keep_trees != 0);
+		return 0;
+	}, -1);
+}
+
+int rbmerge_set_threads(int num_threads, int parallel_threshold) {
+	return guarded([&]() {
+		if (num_threads <= 0) {
+			num_threads = std::thread::hardware_concurrency();
+		}
+		TaskScheduler::SetGlobal(num_threads > 1 ? std::make_shared<TaskScheduler>(num_threads, parallel_threshold > 0 ? parallel_threshold : 1) : nullptr);
+		return 0;
+	}, -1);
+}
+
+rbmerge_result* rbmerge_merge(rbmerge_session* session, const char* merged_pack_name) {
+	return guarded([&]() {
+		if (!session || !merged_pack_name) throw std::runtime_error("No session or merged pack name.");
+		auto result = std::make_unique<rbmerge_result>();
+		result->result = session->session->Merge(merged_pack_name);
+		return result.release();
+	}, nullptr);
+}
+
+rbmerge_result* rbmerge_create_patch(rbmerge_session* session, const char* mod_pack_name, const char* merged_pack_name, int binary_patch) {
+	return guarded([&]() {
+		if (!session || !mod_pack_name) throw std::runtime_error("No session or mod pack name.");
+		auto result = std::make_unique<rbmerge_result>();
+		result->result = session->session->CreatePatch(mod_pack_name, merged_pack_name ? merged_pack_name : "", binary_patch != 0);
+		return result.release();
+	}, nullptr);
+}
+
+void rbmerge_result_free(rbmerge_result* result) {
+	delete result;
+}
+
+int rbmerge_result_success(const rbmerge_result* result) {
+	return result && result->result.success ? 1 : 0;
+}
+
+int rbmerge_result_changed(const rbmerge_result* result) {
+	return result && result->result.changed ? 1 : 0;
+}
+
+size_t rbmerge_result_num_failed(const rbmerge_result* result) {
+	return result ? result->result.numFailed : 0;
+}
+
+size_t rbmerge_result_num_files(const rbmerge_result* result) {
+	return result ? result->result.files.size() : 0;
+}
+
+const char* rbmerge_result_file_name(const rbmerge_result* result, size_t index) {
+	if (!validIndex(result, index, rbmerge_result_num_files(result))) return nullptr;
+	return result->result.files[index].file.c_str();
+}
+
+int rbmerge_result_file_status(const rbmerge_result* result, size_t index) {
+	if (!validIndex(result, index, rbmerge_result_num_files(result))) return -1;
+	return static_cast<int>(result->result.files[index].status);
+}
+
+size_t rbmerge_result_num_messages(const rbmerge_result* result) {
+	return result ? result->result.messages.size() : 0;
+}
+
+const char* rbmerge_result_message_file(const rbmerge_result* result, size_t index) {
+	if (!validIndex(result, index, rbmerge_result_num_messages(result))) return nullptr;
+	return result->result.messages[index].file.c_str();
+}
+
+int rbmerge_result_message_is_error(const rbmerge_result* result, size_t index) {
+	if (!validIndex(result, index, rbmerge_result_num_messages(result))) return -1;
+	return result->result.messages[index].isError ? 1 : 0;
+}
+
+const char* rbmerge_result_message_text(const rbmerge_result* result, size_t index) {
+	if (!validIndex(result, index, rbmerge_result_num_messages(result))) return nullptr;
+	return result->result.messages[index].text.c_str();
+}
+
+const char* rbmerge_last_error(void) {
+	return t_lastError.c_str();
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <stddef.h>
+
+// C interface of RBMergeSession for hosts that can not use C++, like mod managers written in other languages.
+// RiftbreakerMerge.dll is built with RBMERGE_EXPORTS and exports the functions, hosts define RBMERGE_IMPORTS.
+#if defined(_WIN32) && defined(RBMERGE_EXPORTS)
+#define RBMERGE_API __declspec(dllexport)
+#elif defined(_WIN32) && defined(RBMERGE_IMPORTS)
+#define RBMERGE_API __declspec(dllimport)
+#else
+#define RBMERGE_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct rbmerge_session rbmerge_session;
+typedef struct rbmerge_result rbmerge_result;
+
+// status of a file in a result, same values as MergeStatus
+enum {
+	RBMERGE_STATUS_OK = 0,
+	RBMERGE_STATUS_FAILED = 1,
+	RBMERGE_STATUS_NOOP = 2,
+};
+
+// Functions returning a pointer return NULL and functions returning int return -1 on failure,
+// rbmerge_last_error then has the reason for the calling thread. Strings are UTF-8, returned strings
+// stay valid until the result is freed or, for the last error, until the next failing call.
+
+// rules_path NULL for the built in merge rules
+RBMERGE_API rbmerge_session* rbmerge_open(const char* pack_path, const char* rules_path);
+RBMERGE_API void rbmerge_close(rbmerge_session* session);
+// NULL or empty to disable the patch cache
+RBMERGE_API int rbmerge_set_cache_path(rbmerge_session* session, const char* cache_path);
+RBMERGE_API int rbmerge_set_verbose(rbmerge_session* session, int verbose);
+RBMERGE_API int rbmerge_set_keep_trees(rbmerge_session* session, int keep_trees);
+// worker threads of all sessions, 0 for all cores and 1 to merge on the calling thread only,
+// lists with fewer entries than parallel_threshold are merged on one thread (16 in the merger).
+// Must not be called while a request is running.
+RBMERGE_API int rbmerge_set_threads(int num_threads, int parallel_threshold);
+
+// requests block until they are done, results have to be freed with rbmerge_result_free
+RBMERGE_API rbmerge_result* rbmerge_merge(rbmerge_session* session, const char* merged_pack_name);
+// merged_pack_name is left out of the mod packs, NULL if the folder has none
+RBMERGE_API rbmerge_result* rbmerge_create_patch(rbmerge_session* session, const char* mod_pack_name, const char* merged_pack_name, int binary_patch);
+RBMERGE_API void rbmerge_result_free(rbmerge_result* result);
+
+RBMERGE_API int rbmerge_result_success(const rbmerge_result* result);
+RBMERGE_API int rbmerge_result_changed(const rbmerge_result* result);
+RBMERGE_API size_t rbmerge_result_num_failed(const rbmerge_result* result);
+RBMERGE_API size_t rbmerge_result_num_files(const rbmerge_result* result);
+RBMERGE_API const char* rbmerge_result_file_name(const rbmerge_result* result, size_t index);
+RBMERGE_API int rbmerge_result_file_status(const rbmerge_result* result, size_t index);
+// messages in the order they were written, the file name is empty for messages about the whole request
+RBMERGE_API size_t rbmerge_result_num_messages(const rbmerge_result* result);
+RBMERGE_API const char* rbmerge_result_message_file(const rbmerge_result* result, size_t index);
+RBMERGE_API int rbmerge_result_message_is_error(const rbmerge_result* result, size_t index);
+RBMERGE_API const char* rbmerge_result_message_text(const rbmerge_result* result, size_t index);
+
+RBMERGE_API const char* rbmerge_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,437 @@
+#include "RBMergeRegistry.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "RBFile.h"
+
+// the merger's original rules, a rules file passed with -rules replaces them
+static const char* builtinRules = R"(// research tree files
+MergeFiles
+{
+	files
+	{
+		file "scripts/research/research_tree.rt"
+		file "scripts/research/research_tree_prologue.rt"
+		file "scripts/research/research_tree_survival.rt"
+	}
+	default
+	{
+		merge "dict"
+		new "add"
+		removed "ignore"
+		shared "merge"
+	}
+	nodes
+	{
+		// append trees
+		Node
+		{
+			name "categories"
+			merge "list"
+		}
+		Node
+		{
+			name "ResearchTree"
+			key "category"
+		}
+		// append nodes
+		Node
+		{
+			name "nodes"
+			merge "list"
+		}
+		Node
+		{
+			name "ResearchNode"
+			key "research_name"
+		}
+		// append awards
+		Node
+		{
+			name "research_awards"
+			merge "list"
+		}
+		Node
+		{
+			name "ResearchAward"
+			key "blueprint"
+		}
+		// overwrite flags (unused?)
+		Node
+		{
+			name "research_flags"
+			merge "list"
+			shared "replace"
+		}
+		// overwrite tooltip
+		Node
+		{
+			name "requirement_tooltip"
+			shared "replace"
+		}
+		// overwrite requirements
+		Node
+		{
+			name "requirements"
+			merge "list"
+			shared "replace"
+		}
+		Node
+		{
+			name "ResearchNodeRequirement"
+			key "research_name"
+			shared "replace"
+		}
+		// overwrite costs
+		Node
+		{
+			name "research_costs"
+			merge "list"
+			shared "replace"
+		}
+		Node
+		{
+			name "ResearchCost"
+			key "resource"
+			shared "replace"
+		}
+		// overwrite scripts
+		Node
+		{
+			name "research_scripts"
+			merge "list"
+			shared "replace"
+		}
+		Node
+		{
+			name "ResearchScript"
+			key "script_name"
+			shared "replace"
+		}
+		Node
+		{
+			name "Strings"
+			merge "list"
+			shared "replace"
+		}
+		Node
+		{
+			name "StringData"
+			key "key"
+			shared "replace"
+		}
+		Node
+		{
+			name "Floats"
+			merge "list"
+			shared "replace"
+		}
+		Node
+		{
+			name "Vectors"
+			merge "list"
+			shared "replace"
+		}
+		Node
+		{
+			name "Integers"
+			merge "list"
+			shared "replace"
+		}
+		Node
+		{
+			name "IntData"
+			key "key"
+			shared "replace"
+		}
+	}
+}
+
+// weapon stats
+MergeFiles
+{
+	files
+	{
+		file "scripts/blueprint_tables/weapon_stats.dat"
+	}
+	default
+	{
+		merge "dict"
+		new "add"
+		removed "ignore"
+		shared "merge"
+	}
+	nodes
+	{
+		// stats list
+		Node
+		{
+			name "stat_def_vec"
+			merge "list"
+		}
+		Node
+		{
+			name "WeaponStatDef"
+			key "stat_type"
+		}
+	}
+}
+)";
+
+// ? and * do not match '/', ** matches any number of folders
+static bool globMatch(const char* pattern, const char* name)
+{
+	for (; *pattern; ++pattern, ++name) {
+		if (*pattern == '*') {
+			bool anyFolder = pattern[1] == '*';
+			const char* rest = pattern + (anyFolder ? 2 : 1);
+			// "**/" also matches no folder at all
+			if (anyFolder && *rest == '/' && globMatch(rest + 1, name)) {
+				return true;
+			}
+			for (const char* s = name; ; ++s) {
+				if (globMatch(rest, s)) {
+					return true;
+				}
+				if (!*s || (!anyFolder && *s == '/')) {
+					return false;
+				}
+			}
+		}
+		if (!*name || (*pattern == '?' ? *name == '/' : *pattern != *name)) {
+			return false;
+		}
+	}
+	return !*name;
+}
+
+static std::string ruleValue(const std::shared_ptr<RBNode>& node, const std::string& context)
+{
+	if (node->GetType() != RBNodeType::RBNODE_VALUE) {
+		std::stringstream ss;
+		ss << "'" << node->GetName() << "' in " << context << " must be a value.";
+		throw std::runtime_error(ss.str());
+	}
+	std::string value = std::static_pointer_cast<RBNodeValue>(node)->GetValue();
+	return value.substr(1, value.size() - 2);
+}
+
+static std::shared_ptr<RBNodeList> ruleBlock(const std::shared_ptr<RBNode>& node, const std::string& context)
+{
+	if (node->GetType() != RBNodeType::RBNODE_LIST) {
+		std::stringstream ss;
+		ss << "'" << node->GetName() << "' in " << context << " must be a block.";
+		throw std::runtime_error(ss.str());
+	}
+	return std::static_pointer_cast<RBNodeList>(node);
+}
+
+template<typename T>
+static T ruleEnum(const std::string& value, const std::vector<std::pair<std::string, T>>& names, const std::string& field, const std::string& context)
+{
+	for (const auto& [name, type] : names) {
+		if (name == value) {
+			return type;
+		}
+	}
+	std::stringstream ss;
+	ss << "Unknown " << field << " '" << value << "' in " << context << ", expected";
+	for (size_t i = 0; i < names.size(); ++i) {
+		ss << (i == 0 ? " '" : (i + 1 == names.size() ? " or '" : ", '")) << names[i].first << "'";
+	}
+	ss << ".";
+	throw std::runtime_error(ss.str());
+}
+
+// sets one field of a rule, returns false if the node is not a rule field
+static bool parseRuleField(RBMergeRule& rule, const std::shared_ptr<RBNode>& node, const std::string& context)
+{
+	const std::string name = node->GetName();
+	if (name == "merge") {
+		rule.mergeType = ruleEnum<RBMergeType>(ruleValue(node, context), { { "dict", RBMergeType::RBMERGE_DICT }, { "list", RBMergeType::RBMERGE_LIST } }, "merge type", context);
+	}
+	else if (name == "key") {
+		rule.listKey = ruleValue(node, context);
+	}
+	else if (name == "new") {
+		rule.ruleNew = ruleEnum<RBMergeRuleNew>(ruleValue(node, context), { { "ignore", RBMergeRuleNew::RBMERGE_IGNORE }, { "add", RBMergeRuleNew::RBMERGE_ADD } }, "new policy", context);
+	}
+	else if (name == "removed") {
+		rule.ruleRemoved = ruleEnum<RBMergeRuleRemoved>(ruleValue(node, context), { { "ignore", RBMergeRuleRemoved::RBMERGE_IGNORE }, { "remove", RBMergeRuleRemoved::RBMERGE_REMOVE } }, "removed policy", context);
+	}
+	else if (name == "shared") {
+		rule.ruleShared = ruleEnum<RBMergeRuleShared>(ruleValue(node, context), { { "ignore", RBMergeRuleShared::RBMERGE_IGNORE }, { "replace", RBMergeRuleShared::RBMERGE_REPLACE }, { "merge", RBMergeRuleShared::RBMERGE_MERGE } }, "shared policy", context);
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+static void unknownField(const std::shared_ptr<RBNode>& node, const std::string& context)
+{
+	std::stringstream ss;
+	ss << "Unknown field '" << node->GetName() << "' in " << context << ".";
+	throw std::runtime_error(ss.str());
+}
+
+RBMergeRegistry::RBMergeRegistry(std::istream& in, const std::string& source)
+{
+	try {
+		Parse(in, source);
+	}
+	catch (const std::exception& e) {
+		std::stringstream ss;
+		ss << "Invalid merge rules " << source << ": " << e.what();
+		throw std::runtime_error(ss.str());
+	}
+}
+
+void RBMergeRegistry::Parse(std::istream& in, const std::string& source)
+{
+	RBFile rulesFile(in);
+	for (const auto& setNode : rulesFile.GetRoot()->GetNodes()) {
+		if (setNode->GetName() != "MergeFiles") {
+			unknownField(setNode, source);
+		}
+		std::stringstream setContext;
+		setContext << "MergeFiles " << m_ruleSets.size() + 1;
+		auto set = ruleBlock(setNode, setContext.str());
+		size_t ruleSet = m_ruleSets.size();
+
+		// the default is needed first, node rules start from it
+		RBMergeRule defaultRule("", RBMergeType::RBMERGE_DICT, "", RBMergeRuleNew::RBMERGE_ADD, RBMergeRuleRemoved::RBMERGE_IGNORE, RBMergeRuleShared::RBMERGE_MERGE);
+		if (set->Contains(std::string("default"))) {
+			for (const auto& field : ruleBlock(set->GetNode("default"), setContext.str())->GetNodes()) {
+				if (!parseRuleField(defaultRule, field, "default of " + setContext.str())) {
+					unknownField(field, "default of " + setContext.str());
+				}
+			}
+		}
+		auto rules = std::make_shared<RBMergeRules>(std::make_shared<RBMergeRule>(defaultRule));
+
+		size_t numFiles = 0;
+		for (const auto& block : set->GetNodes()) {
+			const std::string blockName = block->GetName();
+			if (blockName == "default") {
+				continue;
+			}
+			if (blockName == "files") {
+				for (const auto& fileNode : ruleBlock(block, setContext.str())->GetNodes()) {
+					if (fileNode->GetName() != "file") {
+						unknownField(fileNode, "files of " + setContext.str());
+					}
+					std::string pattern = ruleValue(fileNode, "files of " + setContext.str());
+					if (pattern.empty()) {
+						throw std::runtime_error("Empty file name in files of " + setContext.str() + ".");
+					}
+					for (const auto& other : m_files) {
+						if (other.pattern == pattern) {
+							throw std::runtime_error("File '" + pattern + "' is listed more than once.");
+						}
+					}
+					bool exact = pattern.find_first_of("*?") == std::string::npos;
+					if (exact) {
+						m_exact.emplace(pattern, ruleSet);
+					}
+					else {
+						m_patterns.push_back(m_files.size());
+					}
+					m_files.push_back({ pattern, ruleSet, exact });
+					++numFiles;
+				}
+			}
+			else if (blockName == "nodes") {
+				std::set<std::string> names;
+				for (const auto& ruleNode : ruleBlock(block, setContext.str())->GetNodes()) {
+					if (ruleNode->GetName() != "Node") {
+						unknownField(ruleNode, "nodes of " + setContext.str());
+					}
+					RBMergeRule rule = defaultRule;
+					std::string nodeName;
+					for (const auto& field : ruleBlock(ruleNode, "nodes of " + setContext.str())->GetNodes()) {
+						if (field->GetName() == "name") {
+							nodeName = ruleValue(field, "nodes of " + setContext.str());
+						}
+						else if (!parseRuleField(rule, field, "Node '" + nodeName + "' of " + setContext.str())) {
+							unknownField(field, "Node '" + nodeName + "' of " + setContext.str());
+						}
+					}
+					if (nodeName.empty()) {
+						throw std::runtime_error("Node without name in " + setContext.str() + ".");
+					}
+					if (!names.insert(nodeName).second) {
+						throw std::runtime_error("Node '" + nodeName + "' has more than one rule in " + setContext.str() + ".");
+					}
+					rules->Add(nodeName, std::make_shared<RBMergeRule>(rule));
+				}
+			}
+			else {
+				unknownField(block, setContext.str());
+			}
+		}
+		if (numFiles == 0) {
+			throw std::runtime_error(setContext.str() + " has no files.");
+		}
+		m_ruleSets.push_back(rules);
+	}
+	if (m_ruleSets.empty()) {
+		throw std::runtime_error("No MergeFiles found.");
+	}
+}
+
+std::shared_ptr<RBMergeRegistry> RBMergeRegistry::Load(const std::filesystem::path& path)
+{
+	std::ifstream in(path);
+	if (!in) {
+		std::stringstream ss;
+		ss << "Failed to open merge rules " << path << ".";
+		throw std::runtime_error(ss.str());
+	}
+	std::stringstream source;
+	source << path;
+	return std::make_shared<RBMergeRegistry>(in, source.str());
+}
+
+std::shared_ptr<RBMergeRegistry> RBMergeRegistry::Builtin()
+{
+	std::istringstream in(builtinRules);
+	return std::make_shared<RBMergeRegistry>(in, "(built in)");
+}
+
+std::shared_ptr<RBMergeRules> RBMergeRegistry::Find(const std::string& fileName) const
+{
+	auto exact = m_exact.find(fileName);
+	if (exact != m_exact.end()) {
+		return m_ruleSets[exact->second];
+	}
+	for (size_t index : m_patterns) {
+		if (globMatch(m_files[index].pattern.c_str(), fileName.c_str())) {
+			return m_ruleSets[m_files[index].ruleSet];
+		}
+	}
+	return nullptr;
+}
+
+std::vector<std::pair<std::string, std::shared_ptr<RBMergeRules>>> RBMergeRegistry::Files(const std::set<std::string>& availableFiles) const
+{
+	std::vector<std::pair<std::string, std::shared_ptr<RBMergeRules>>> files;
+	std::set<std::string> added;
+	for (const auto& file : m_files) {
+		if (file.exact) {
+			if (added.insert(file.pattern).second) {
+				files.emplace_back(file.pattern, m_ruleSets[file.ruleSet]);
+			}
+			continue;
+		}
+		for (const auto& name : availableFiles) {
+			// exact names and earlier patterns take precedence
+			if (added.count(name) > 0 || !globMatch(file.pattern.c_str(), name.c_str()) || Find(name) != m_ruleSets[file.ruleSet]) {
+				continue;
+			}
+			added.insert(name);
+			files.emplace_back(name, m_ruleSets[file.ruleSet]);
+		}
+	}
+	return files;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <filesystem>
+#include <istream>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "RBMergeRules.h"
+
+// Mergeable files and the rules to merge their nodes, read from a rules file in the game's own data format:
+//
+// MergeFiles
+// {
+//     files
+//     {
+//         file "scripts/research/*.rt"
+//     }
+//     default
+//     {
+//         merge "dict"
+//         new "add"
+//         removed "ignore"
+//         shared "merge"
+//     }
+//     nodes
+//     {
+//         Node
+//         {
+//             name "nodes"
+//             merge "list"
+//         }
+//     }
+// }
+//
+// Fields of a node that are not set are taken from the default. File patterns can use ? and *,
+// which do not match '/', and ** for any number of folders. The rules are validated on load and
+// compiled into a table of exact file names and a list of patterns.
+class RBMergeRegistry
+{
+public:
+	// throws if the rules are not valid, source names them in the error messages
+	RBMergeRegistry(std::istream& in, const std::string& source);
+	static std::shared_ptr<RBMergeRegistry> Load(const std::filesystem::path& path);
+	// rules built into the merger, used if there is no rules file
+	static std::shared_ptr<RBMergeRegistry> Builtin();
+
+	// rules of a file, nullptr if it is not merged
+	std::shared_ptr<RBMergeRules> Find(const std::string& fileName) const;
+	bool HasPatterns() const { return !m_patterns.empty(); }
+	// files to merge in the order of the rules, exact file names and the available files matching a pattern
+	std::vector<std::pair<std::string, std::shared_ptr<RBMergeRules>>> Files(const std::set<std::string>& availableFiles) const;
+private:
+	struct FilePattern {
+		std::string pattern;
+		size_t ruleSet;
+		bool exact;
+	};
+	void Parse(std::istream& in, const std::string& source);
+
+	std::vector<std::shared_ptr<RBMergeRules>> m_ruleSets;
+	// all file entries in the order of the rules file
+	std::vector<FilePattern> m_files;
+	std::unordered_map<std::string, size_t> m_exact;
+	std::vector<size_t> m_patterns;
+};
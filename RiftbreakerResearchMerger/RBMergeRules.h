@@ -1,8 +1,10 @@
 #pragma once
 #include <memory>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <string>
+#include <cstdint>
 
 enum class RBMergeType {
 	RBMERGE_DICT = 0,
@@ -41,10 +43,11 @@ class RBMergeRules {
 public:
 	RBMergeRules(const std::shared_ptr<RBMergeRule> defaultRule) : m_defaultRule(defaultRule) {}
 	void Add(const std::string& name, const std::shared_ptr<RBMergeRule> rule) { m_rules.emplace(name, rule); }
-	const std::shared_ptr<RBMergeRule> Get(const std::string& name) const;
+	// looked up for every node, the reference stays valid as long as the rules
+	const std::shared_ptr<RBMergeRule>& Get(const std::string& name) const;
+	// stable hash of all rules, changes whenever a rule changes
+	uint64_t Fingerprint() const;
 private:
-	std::map<std::string, std::shared_ptr<RBMergeRule>> m_rules;
+	std::unordered_map<std::string, std::shared_ptr<RBMergeRule>> m_rules;
 	const std::shared_ptr<RBMergeRule> m_defaultRule;
-};
-
-std::vector<std::pair<std::vector<std::string>, std::shared_ptr<RBMergeRules>>> getKnownMergeFilesRules();
\ No newline at end of file
+};
\ No newline at end of file
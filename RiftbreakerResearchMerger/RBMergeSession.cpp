@@ -0,0 +1,1645 @@
+#include "RBMergeSession.h"
+#include <stdexcept>
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <regex>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include "miniz/miniz.h"
+#include "RBFile.h"
+#include "RBMergeRules.h"
+#include "TaskScheduler.h"
+#include "RBDeflateStream.h"
+#include "RBBinaryPatch.h"
+#include "Timings.h"
+#include "MemoryReport.h"
+#include "Trace.h"
+#include "ModCostReport.h"
+#include "RBPackReader.h"
+#include "RBPackIndex.h"
+#include "RBCrc32.h"
+
+const char* patchExt = ".merge";
+const char* binaryPatchExt = ".merge.bin";
+// bump when the patch creation changes, invalidates all cached patches
+const int patchCacheVersion = 1;
+// serialized text is compressed in chunks of this size while it is written
+const size_t compressChunkSize = 64 * 1024;
+
+// Readers of the packs used while creating patches, every pack is opened once per run instead of for every file.
+struct PackReaders {
+    std::map<std::filesystem::path, std::unique_ptr<RBPackReader>> readers;
+
+    RBPackReader& Get(const std::filesystem::path& path) {
+        std::unique_ptr<RBPackReader>& reader = readers[path];
+        if (!reader) {
+            reader = std::make_unique<RBPackReader>(path);
+        }
+        return *reader;
+    }
+};
+
+bool archiveHasFile(RBPackReader& pack, const std::string &fileName, std::ostream& err) {
+    mz_zip_archive* zip_archive = pack.Zip();
+    if (!zip_archive)
+    {
+        err << "Failed to read pack " << pack.GetPath() << ": " << pack.GetError() << std::endl;
+        //debugging large archive error
+        /*
+        std::cout << "[TEST] " << "archive size: " << zip_archive.m_archive_size;
+        std::cout << ", total files: " << zip_archive.m_total_files;
+        std::cout << ", zip mode: " << zip_archive.m_zip_mode;
+        std::cout << ", zip type: " << zip_archive.m_zip_type;
+        std::cout << std::endl;
+        throw std::runtime_error("DEBUG");
+        */
+        return false;
+    }
+
+    int i = mz_zip_reader_locate_file(zip_archive, fileName.c_str(), nullptr, 0);
+
+    return i >= 0;
+}
+
+// Entries of all packs in the packs folder, read in one pass over their cached indexes or central directories.
+struct PackCatalog {
+    struct Pack {
+        std::filesystem::path path;
+        bool isBase;
+        // entries are looked up here instead of in the central directory of the pack
+        std::shared_ptr<const RBPackIndex> index;
+    };
+    struct File {
+        // name as stored in the latest base pack, or the first mod pack if no base pack has the file
+        std::string name;
+        int basePack = -1;
+        // mod packs in load order, true if the pack has a patch of the file
+        std::vector<std::pair<size_t, bool>> modPacks;
+    };
+    // in load order
+    std::vector<Pack> packs;
+    // by lower case name, pack lookups ignore the case like miniz
+    std::unordered_map<std::string, File> files;
+};
+
+static std::string lowerCase(std::string name) {
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return name;
+}
+
+static bool hasSuffix(const std::string& name, const std::string& suffix) {
+    return name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::string packStamp(const std::filesystem::path& path) {
+    std::error_code error;
+    auto size = std::filesystem::file_size(path, error);
+    auto time = std::filesystem::last_write_time(path, error);
+    std::stringstream ss;
+    ss << path.string() << ':' << size << ':' << time.time_since_epoch().count();
+    return ss.str();
+}
+
+// The indexes of unchanged packs are read from the cache folder, only the other packs are opened.
+PackCatalog readPackCatalog(const std::filesystem::path& packPath, const std::string& mergedPackName, const std::filesystem::path& cachePath, std::ostream& err) {
+    std::set<std::filesystem::path> sortedPacks;
+    for (const auto& file : std::filesystem::directory_iterator(packPath)) {
+        sortedPacks.insert(file.path());
+    }
+
+    std::regex basePackMask("\\d\\d_.+_data\\.zip$", std::regex_constants::icase);
+    std::regex ignorePackMask("\\d\\d_.+_(audio|video)\\.zip$", std::regex_constants::icase);
+    std::regex archiveMask(".+.zip$", std::regex_constants::icase);
+    const std::string textExt(patchExt);
+    const std::string binaryExt(binaryPatchExt);
+
+    struct PackRead {
+        std::filesystem::path path;
+        // taken before the pack is read, a pack changing meanwhile is read again next time
+        std::string stamp;
+        std::shared_ptr<RBPackIndex> index;
+        std::unique_ptr<RBPackReader> reader;
+    };
+    std::vector<PackRead> reads;
+    for (const auto& file : sortedPacks) {
+        if (std::filesystem::is_directory(file)) {
+            continue;
+        }
+        std::string archiveName = file.filename().string();
+        if (std::regex_search(archiveName, ignorePackMask) || archiveName == mergedPackName || !std::regex_search(archiveName, archiveMask)) {
+            continue;
+        }
+        PackRead read{ file, packStamp(file), nullptr, nullptr };
+        if (!cachePath.empty()) {
+            TimingScope timing(TimingPhase::OPEN, archiveName);
+            read.index = RBPackIndex::Load(RBPackIndex::GetIndexPath(cachePath, file), read.stamp);
+        }
+        read.reader = std::make_unique<RBPackReader>(file, read.index);
+        reads.push_back(std::move(read));
+    }
+    {
+        TimingScope timing(TimingPhase::OPEN);
+        std::vector<RBPackReader*> packs;
+        for (const auto& read : reads) {
+            packs.push_back(read.reader.get());
+        }
+        RBPackReader::ReadDirectories(packs);
+    }
+
+    PackCatalog catalog;
+    for (auto& read : reads) {
+        const std::filesystem::path& file = read.path;
+        std::string archiveName = file.filename().string();
+        bool isBase = std::regex_search(archiveName, basePackMask);
+
+        if (!read.index) {
+            TimingScope timing(TimingPhase::OPEN, archiveName);
+            read.index = RBPackIndex::Build(*read.reader, read.stamp);
+            if (!read.index) {
+                err << "Failed to read pack " << file << ": " << read.reader->GetError() << std::endl;
+                continue;
+            }
+            if (!cachePath.empty()) {
+                try {
+                    read.index->Save(RBPackIndex::GetIndexPath(cachePath, file));
+                }
+                catch (const std::exception& e) {
+                    err << "WARNING: Failed to cache index of pack " << file << ": " << e.what() << std::endl;
+                }
+            }
+        }
+        size_t packIndex = catalog.packs.size();
+        catalog.packs.push_back({ file, isBase, read.index });
+
+        for (const RBPackIndex::Entry& indexEntry : read.index->GetEntries()) {
+            if (indexEntry.isDirectory) {
+                continue;
+            }
+            const std::string& entry = indexEntry.name;
+            if (isBase) {
+                PackCatalog::File& catalogFile = catalog.files[lowerCase(entry)];
+                catalogFile.name = entry;
+                catalogFile.basePack = static_cast<int>(packIndex);
+                continue;
+            }
+            if (hasSuffix(entry, binaryExt)) {
+                continue;
+            }
+            bool isPatch = hasSuffix(entry, textExt);
+            std::string fileName = isPatch ? entry.substr(0, entry.size() - textExt.size()) : entry;
+            PackCatalog::File& catalogFile = catalog.files[lowerCase(fileName)];
+            // files that are in no base pack keep the name of the first mod pack
+            if (catalogFile.name.empty()) {
+                catalogFile.name = fileName;
+            }
+            // a patch wins over a full file in the same pack
+            if (!catalogFile.modPacks.empty() && catalogFile.modPacks.back().first == packIndex) {
+                catalogFile.modPacks.back().second |= isPatch;
+            }
+            else {
+                catalogFile.modPacks.emplace_back(packIndex, isPatch);
+            }
+        }
+    }
+    return catalog;
+}
+
+// latest base pack of the file and the mod packs changing it in load order, true if the mod pack has a patch
+std::pair<std::filesystem::path, std::vector<std::pair<std::filesystem::path, bool>>> getArchivesForMerge(const PackCatalog& catalog, const std::string& fileName) {
+    std::filesystem::path basePack("");
+    std::vector<std::pair<std::filesystem::path, bool>> modPacks;
+    auto file = catalog.files.find(lowerCase(fileName));
+    if (file != catalog.files.end()) {
+        if (file->second.basePack >= 0) {
+            basePack = catalog.packs[file->second.basePack].path;
+        }
+        for (const auto& [packIndex, isPatch] : file->second.modPacks) {
+            modPacks.push_back(std::pair(catalog.packs[packIndex].path, isPatch));
+        }
+    }
+    return std::pair<std::filesystem::path, std::vector<std::pair<std::filesystem::path, bool>>>(basePack, modPacks);
+}
+
+// index of a pack of the catalog, nullptr for other packs
+std::shared_ptr<const RBPackIndex> getPackIndex(const PackCatalog& catalog, const std::filesystem::path& path) {
+    for (const auto& pack : catalog.packs) {
+        if (pack.path == path) {
+            return pack.index;
+        }
+    }
+    return nullptr;
+}
+
+// files that are in a base pack and changed by a mod pack, candidates for the file patterns of the merge rules
+std::set<std::string> getModifiedFiles(const PackCatalog& catalog) {
+    std::set<std::string> modified;
+    for (const auto& [key, file] : catalog.files) {
+        if (file.basePack >= 0 && !file.modPacks.empty()) {
+            modified.insert(file.name);
+        }
+    }
+    return modified;
+}
+
+// files that are in no base pack but in more than one mod pack, with the mod packs in load order
+std::map<std::string, std::vector<std::filesystem::path>> getConflictsWithoutBase(const PackCatalog& catalog) {
+    std::map<std::string, std::vector<std::filesystem::path>> conflicts;
+    for (const auto& [key, file] : catalog.files) {
+        if (file.basePack < 0 && file.modPacks.size() > 1) {
+            std::vector<std::filesystem::path>& packs = conflicts[file.name];
+            for (const auto& modPack : file.modPacks) {
+                packs.push_back(catalog.packs[modPack.first].path);
+            }
+        }
+    }
+    return conflicts;
+}
+
+std::filesystem::path getBaseArchiveForFile(const std::filesystem::path& packPath, const std::string& fileName, PackReaders& readers, std::ostream& err) {
+
+    std::set<std::filesystem::path> sortedPacks;
+    for (const auto& file : std::filesystem::directory_iterator(packPath)) {
+        sortedPacks.insert(file.path());
+    }
+
+    std::regex basePackMask("\\d\\d_.+_data\\.zip$", std::regex_constants::icase);
+    std::regex ignorePackMask("\\d\\d_.+_(audio|video)\\.zip$", std::regex_constants::icase);
+    //std::regex archiveMask(".+.zip$", std::regex_constants::icase);
+
+    std::filesystem::path basePack("");
+    std::string basePackFileName("");
+
+    for (const auto& file : sortedPacks) {
+        if (std::filesystem::is_directory(file)) {
+            continue;
+        }
+        std::string archiveName = file.filename().string();
+        //std::cout << "Checking file " << archiveName << std::endl;
+        if (std::regex_search(archiveName, ignorePackMask)) {
+            //std::cout << "Ignored file." << std::endl;
+            continue;
+        }
+
+        if (std::regex_search(archiveName, basePackMask)) {
+            //std::cout << "Is base pack." << std::endl;
+            if (fileName.compare(basePackFileName) > 0 && archiveHasFile(readers.Get(file), fileName, err)) { //
+                //std::cout << "Has file." << std::endl;
+                basePack = file;
+                basePackFileName = archiveName;
+            }
+        }
+    }
+
+    return basePack;
+}
+
+// Read-only stream over extracted data, the data is parsed in place instead of being copied into a string stream.
+struct MemoryStreamBuf : std::streambuf {
+    MemoryStreamBuf(char* data, size_t size) {
+        setg(data, data, data + size);
+    }
+};
+
+std::shared_ptr<RBFile> readRBFile(RBPackReader& pack, const std::string &fileName, size_t* extractedSize = nullptr) {
+    std::string packName = pack.GetPath().filename().string();
+    bool readable;
+    {
+        TimingScope timing(TimingPhase::OPEN, packName);
+        readable = pack.IsReadable();
+    }
+    if (!readable)
+    {
+        //printf("mz_zip_reader_init_file() failed!\n");
+        throw std::runtime_error("Failed to initialize archive.");
+    }
+
+    RBBufferPool::Buffer file;
+    {
+        TimingScope timing(TimingPhase::EXTRACT, packName);
+        if (!pack.Extract(fileName, file)) {
+            throw std::runtime_error("Failed to read from archive.");
+        }
+        if (extractedSize) *extractedSize = file.Size();
+    }
+
+    TimingScope timing(TimingPhase::PARSE, packName);
+    MemoryStreamBuf streamBuf(file.Data(), file.Size());
+    std::istream instream(&streamBuf);
+
+    std::shared_ptr<RBFile> researchFile = std::make_shared<RBFile>(instream);
+    return researchFile;
+}
+
+// Serializes the file straight into the compressor, only the compressed data is kept in memory.
+mz_bool writeRBFileToArchive(mz_zip_archive* archive, const std::string& fileName, std::shared_ptr<RBFile> file) {
+    RBWriteBuffer buffer;
+    size_t size = file->GetSerializedSize();
+    if (size < compressChunkSize) {
+        // small file that fits into a single chunk
+        {
+            TimingScope timing(TimingPhase::SERIALIZE);
+            buffer.Reserve(size);
+            file->Serialize(buffer);
+        }
+        TimingScope timing(TimingPhase::COMPRESS);
+        return mz_zip_writer_add_mem(archive, fileName.c_str(), buffer.Data(), buffer.Size(), MZ_BEST_COMPRESSION);
+    }
+
+    RBDeflateStream deflate(MZ_BEST_COMPRESSION);
+    {
+        // compression time is taken out of the serialization time by the nested scope
+        TimingScope timing(TimingPhase::SERIALIZE);
+        buffer.SetFlush(compressChunkSize, [&deflate](const char* data, size_t length) {
+            TimingScope timing(TimingPhase::COMPRESS);
+            deflate.Write(data, length);
+        });
+        file->Serialize(buffer);
+        buffer.Flush();
+    }
+    {
+        TimingScope timing(TimingPhase::COMPRESS);
+        deflate.Finish();
+    }
+    TimingScope timing(TimingPhase::WRITE);
+    return mz_zip_writer_add_mem_ex_v2(archive, fileName.c_str(), deflate.Data(), deflate.Size(), nullptr, 0, MZ_BEST_COMPRESSION | MZ_ZIP_FLAG_COMPRESSED_DATA,
+        deflate.UncompressedSize(), deflate.Crc32(), nullptr, nullptr, 0, nullptr, 0);
+}
+
+// binary version of a text patch, nullptr if there is none or it does not match the text patch anymore
+std::shared_ptr<RBFile> readBinaryPatchFile(RBPackReader& pack, const std::string& fileName, std::shared_ptr<RBMergeRules> rules, std::ostream& err, size_t* extractedSize = nullptr) {
+    std::string packName = pack.GetPath().filename().string();
+    std::shared_ptr<RBFile> patchFile;
+    std::string textName = fileName + patchExt;
+    std::string binaryName = fileName + binaryPatchExt;
+    mz_zip_archive_file_stat textStat;
+    mz_zip_archive_file_stat binaryStat;
+    bool found;
+    {
+        TimingScope timing(TimingPhase::OPEN, packName);
+        found = pack.Stat(textName, textStat) && pack.Stat(binaryName, binaryStat);
+    }
+    if (found) {
+        RBBufferPool::Buffer data;
+        bool extracted;
+        {
+            TimingScope timing(TimingPhase::EXTRACT, packName);
+            extracted = pack.Extract(binaryName, data);
+        }
+        if (extracted) {
+            if (extractedSize) *extractedSize = data.Size();
+            TimingScope timing(TimingPhase::PARSE, packName);
+            try {
+                patchFile = readBinaryPatch(data.Data(), data.Size(), textStat.m_crc32, textStat.m_uncomp_size, rules);
+            }
+            catch (const std::exception& e) {
+                err << "WARNING: Ignoring invalid binary patch " << binaryName << ": " << e.what() << std::endl;
+            }
+        }
+    }
+
+    return patchFile;
+}
+
+// Output pack of a merge run. It is written to a temporary file, entries with the same content
+// as in the previous output are copied over compressed and the previous pack is only replaced if anything changed.
+struct MergedPack {
+    std::filesystem::path path;
+    std::filesystem::path tempPath;
+    mz_zip_archive writer;
+    mz_zip_archive previous;
+    bool hasPrevious = false;
+    size_t numFiles = 0;
+    size_t numChanged = 0;
+};
+
+uint32_t serializedCrc32(std::shared_ptr<RBFile> file) {
+    uint32_t crc = MZ_CRC32_INIT;
+    RBWriteBuffer buffer;
+    buffer.SetFlush(compressChunkSize, [&crc](const char* data, size_t length) {
+        crc = zipCrc32(crc, data, length);
+    });
+    file->Serialize(buffer);
+    buffer.Flush();
+    return crc;
+}
+
+bool openMergedPack(MergedPack& pack, const std::filesystem::path& path, std::ostream& err) {
+    pack.path = path;
+    pack.tempPath = path.string() + ".temp";
+    memset(&pack.writer, 0, sizeof(pack.writer));
+    memset(&pack.previous, 0, sizeof(pack.previous));
+
+    if (std::filesystem::exists(path)) {
+        pack.hasPrevious = mz_zip_reader_init_file(&pack.previous, path.string().c_str(), 0);
+        if (!pack.hasPrevious) {
+            err << "WARNING: Failed to read old merged pack " << path << ", it will be replaced." << std::endl;
+        }
+    }
+    if (!mz_zip_writer_init_file(&pack.writer, pack.tempPath.string().c_str(), 0)) {
+        err << "ERROR: Failed to create temporary pack " << pack.tempPath << "." << std::endl;
+        if (pack.hasPrevious) {
+            mz_zip_reader_end(&pack.previous);
+        }
+        return false;
+    }
+    return true;
+}
+
+bool addMergedFile(MergedPack& pack, const std::string& fileName, std::shared_ptr<RBFile> file, std::ostream& err) {
+    mz_bool status;
+    int previousIndex = pack.hasPrevious ? mz_zip_reader_locate_file(&pack.previous, fileName.c_str(), nullptr, 0) : -1;
+    mz_zip_archive_file_stat previousStat;
+    bool unchanged = false;
+    if (previousIndex >= 0 && mz_zip_reader_file_stat(&pack.previous, previousIndex, &previousStat)
+        && previousStat.m_uncomp_size == file->GetSerializedSize()) {
+        TimingScope timing(TimingPhase::SERIALIZE);
+        unchanged = previousStat.m_crc32 == serializedCrc32(file);
+    }
+    if (unchanged) {
+        // same content as before, keep the old compressed entry
+        TimingScope timing(TimingPhase::WRITE);
+        status = mz_zip_writer_add_from_zip_reader(&pack.writer, &pack.previous, previousIndex);
+    }
+    else {
+        status = writeRBFileToArchive(&pack.writer, fileName, file);
+        ++pack.numChanged;
+    }
+    if (!status)
+    {
+        err << "ERROR: Failed to write '" << fileName << "' to archive '" << pack.tempPath << "'.";
+        return false;
+    }
+    ++pack.numFiles;
+    return true;
+}
+
+// returns false if the previous pack is still up to date and was kept
+bool closeMergedPack(MergedPack& pack) {
+    bool changed = pack.numChanged > 0 || !pack.hasPrevious || mz_zip_reader_get_num_files(&pack.previous) != pack.numFiles;
+    if (pack.hasPrevious) {
+        mz_zip_reader_end(&pack.previous);
+    }
+    mz_bool status = mz_zip_writer_finalize_archive(&pack.writer);
+    if (!mz_zip_writer_end(&pack.writer)) {
+        status = MZ_FALSE;
+    }
+    if (!status) {
+        std::filesystem::remove(pack.tempPath);
+        throw std::runtime_error("Failed to finalize temporary pack " + pack.tempPath.string() + ".");
+    }
+
+    if (!changed) {
+        std::filesystem::remove(pack.tempPath);
+        return false;
+    }
+    if (pack.numFiles == 0) {
+        // nothing to merge, no output pack at all
+        std::filesystem::remove(pack.tempPath);
+        return std::filesystem::remove(pack.path);
+    }
+    // replaces the previous pack in one step
+    std::filesystem::rename(pack.tempPath, pack.path);
+    return true;
+}
+
+// Parsed trees kept between the merges of a session. Every tree is stored with the size and
+// write time of the packs it was made from and is only used again while they are unchanged.
+struct ResidentTrees {
+    struct Tree {
+        std::string stamp;
+        std::shared_ptr<RBFile> tree;
+        size_t lastRun = 0;
+    };
+    typedef std::map<std::string, Tree> TreeMap;
+
+    std::shared_ptr<RBFile> Get(TreeMap& trees, const std::string& key, const std::string& stamp) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto tree = trees.find(key);
+        if (tree == trees.end() || tree->second.stamp != stamp) {
+            return nullptr;
+        }
+        tree->second.lastRun = run;
+        return tree->second.tree;
+    }
+    void Set(TreeMap& trees, const std::string& key, const std::string& stamp, std::shared_ptr<RBFile> tree) {
+        std::lock_guard<std::mutex> lock(mutex);
+        trees[key] = { stamp, tree, run };
+    }
+    // drops the trees of files and packs that were not used by the last merge
+    void Prune() {
+        for (TreeMap* trees : { &bases, &patches, &merged }) {
+            for (auto tree = trees->begin(); tree != trees->end();) {
+                tree = tree->second.lastRun == run ? std::next(tree) : trees->erase(tree);
+            }
+        }
+    }
+
+    std::mutex mutex;
+    size_t run = 0;
+    // by pack path and file name
+    TreeMap bases;
+    TreeMap patches;
+    // merge results by file name, stamped with all packs of the file
+    TreeMap merged;
+};
+
+bool getFileStat(RBPackReader& pack, const std::string& fileName, mz_zip_archive_file_stat& fileStat) {
+    TimingScope timing(TimingPhase::OPEN, pack.GetPath().filename().string());
+    return pack.Stat(fileName, fileStat);
+}
+
+// patches only depend on the mod file, the base file and the rules, so they are cached by those
+std::filesystem::path getPatchCachePath(const std::filesystem::path& cachePath, const std::string& fileName, const mz_zip_archive_file_stat& modStat, const mz_zip_archive_file_stat& baseStat, std::shared_ptr<RBMergeRules> rules) {
+    std::stringstream ss;
+    ss << std::filesystem::path(fileName).filename().string() << "_v" << patchCacheVersion << std::hex << std::setfill('0')
+        << "_" << std::setw(8) << modStat.m_crc32 << "-" << modStat.m_uncomp_size
+        << "_" << std::setw(8) << baseStat.m_crc32 << "-" << baseStat.m_uncomp_size
+        << "_" << std::setw(16) << rules->Fingerprint() << patchExt;
+    return std::filesystem::path(cachePath).append(ss.str());
+}
+
+std::shared_ptr<RBFile> readCachedPatch(const std::filesystem::path& patchPath, std::ostream& err) {
+    if (!std::filesystem::exists(patchPath)) {
+        return nullptr;
+    }
+    try {
+        std::ifstream instream(patchPath, std::ios::binary);
+        return std::make_shared<RBFile>(instream);
+    }
+    catch (const std::exception& e) {
+        err << "WARNING: Ignoring broken cached patch " << patchPath << ": " << e.what() << std::endl;
+        return nullptr;
+    }
+}
+
+// Mods that ship the same file against the same base share a cache key and write their patch at the same time,
+// every writer gets its own temporary file. The patches are equal, the last rename wins.
+bool writeCachedPatch(const std::filesystem::path& patchPath, std::shared_ptr<RBFile> file, std::ostream& err) {
+    // write to a temporary file first, so an interrupted run never leaves a partial patch
+    std::filesystem::path tempPath = uniqueTempPath(patchPath);
+    try {
+        std::filesystem::create_directories(patchPath.parent_path());
+        {
+            std::ofstream outstream(tempPath, std::ios::binary | std::ios::trunc);
+            file->Serialize(outstream);
+            if (!outstream) {
+                throw std::runtime_error("Failed to write file.");
+            }
+        }
+        std::filesystem::rename(tempPath, patchPath);
+    }
+    catch (const std::exception& e) {
+        std::error_code error;
+        std::filesystem::remove(tempPath, error);
+        err << "WARNING: Failed to cache patch " << patchPath << ": " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void printRemovedCounts(const std::map<std::string, size_t>& removedCounts, std::ostream& out) {
+    size_t total = 0;
+    for (const auto& [listName, count] : removedCounts) {
+        total += count;
+    }
+    out << "Removed " << total << " unchanged nodes";
+    if (total > 0) {
+        out << " (";
+        for (auto it = removedCounts.begin(); it != removedCounts.end(); ++it) {
+            if (it != removedCounts.begin()) out << ", ";
+            out << it->first << ": " << it->second;
+        }
+        out << ")";
+    }
+    out << "." << std::endl;
+}
+
+// Merges all mod packs changing the file into a copy of its base version. Runs on any thread,
+// so the messages go to out and err and the result is only added to the merged pack by the caller.
+// With resident set, unchanged trees of earlier merges are used instead of reading the packs again.
+MergeStatus createMergeFile(const PackCatalog& catalog, const std::string& fileName, std::shared_ptr<RBMergeRules> rules, const std::filesystem::path& cachePath, ResidentTrees* resident, std::shared_ptr<RBFile>& mergedFile, std::ostream& out, std::ostream& err, const bool verbose) {
+    out << std::endl << "Merging '" << fileName << "'." << std::endl;
+    Timings::SetFile(fileName);
+    TraceScope trace("file", fileName);
+    
+    std::pair<std::filesystem::path, std::vector<std::pair<std::filesystem::path, bool>>> paths;
+    {
+        TimingScope timing(TimingPhase::DISCOVERY);
+        paths = getArchivesForMerge(catalog, fileName);
+    }
+    auto basePath = paths.first;
+    if (basePath.empty()) {
+        err << "ERROR: Could not find base pack for file " << fileName << "." << std::endl;
+        return MergeStatus::FAILED;
+    }
+    auto modPaths = paths.second;
+    if (modPaths.size() == 0) {
+        if(verbose) out << "File " << fileName << " is not modified by any mods." << std::endl;
+        return MergeStatus::OK;
+    }
+    if (verbose) out << "Found latest base file in " << basePath << ", modified by " << modPaths.size() << " mod packs." << std::endl;
+
+    std::string baseStamp;
+    std::string mergedStamp;
+    if (resident) {
+        baseStamp = packStamp(basePath);
+        std::stringstream ss;
+        ss << rules->Fingerprint() << '|' << baseStamp;
+        for (const auto& modPack : modPaths) {
+            ss << '|' << packStamp(modPack.first) << (modPack.second ? "|patch" : "");
+        }
+        mergedStamp = ss.str();
+        mergedFile = resident->Get(resident->merged, fileName, mergedStamp);
+        if (mergedFile) {
+            if (verbose) out << "No pack changed, using the previous merge." << std::endl;
+            return MergeStatus::OK;
+        }
+    }
+
+    // The base and the mod packs are read on worker threads. Each full file mod is diffed against
+    // the base as soon as both are parsed and the patches are taken over in load order, with only
+    // a few mods read ahead so that not too many full trees are held at the same time.
+    std::shared_ptr<TaskScheduler> scheduler = TaskScheduler::Global();
+    std::shared_ptr<RBFile> baseReseachFile;
+    std::shared_ptr<RBFile> mergeFile;
+    std::stringstream baseOut;
+    std::stringstream baseErr;
+    std::atomic<bool> baseFailed(false);
+
+    // the packs of the file, their central directories and the entries to extract are read in batches
+    RBPackReader basePack(basePath, getPackIndex(catalog, basePath));
+    std::vector<std::unique_ptr<RBPackReader>> modPacks;
+    std::vector<RBPackReader*> packs = { &basePack };
+    for (const auto& modPack : modPaths) {
+        modPacks.push_back(std::make_unique<RBPackReader>(modPack.first, getPackIndex(catalog, modPack.first)));
+        packs.push_back(modPacks.back().get());
+    }
+    {
+        TimingScope timing(TimingPhase::OPEN);
+        RBPackReader::ReadDirectories(packs);
+    }
+
+    mz_zip_archive_file_stat baseStat;
+    bool useCache = !cachePath.empty() && getFileStat(basePack, fileName, baseStat);
+
+    struct ModRead {
+        std::shared_ptr<RBFile> modFile;
+        std::shared_ptr<RBFile> residentPatch;
+        ModCost cost;
+        std::filesystem::path cachedPatchPath;
+        bool isResident = false;
+        bool needsDiff = false;
+        bool failed = false;
+        std::chrono::steady_clock::duration time{};
+        // the base and the mod file, the diff runs once both are read
+        std::atomic<int> waiting{ 2 };
+        std::atomic<bool> done{ false };
+        std::stringstream out;
+        std::stringstream err;
+    };
+    std::vector<ModRead> mods(modPaths.size());
+
+    // kept and cached trees are used instead of the packs, the other entries are read ahead
+    std::vector<std::pair<RBPackReader*, std::string>> entries;
+    if (resident) baseReseachFile = resident->Get(resident->bases, basePath.string() + '|' + fileName, baseStamp);
+    if (!baseReseachFile) entries.emplace_back(&basePack, fileName);
+    for (size_t i = 0; i < mods.size(); ++i) {
+        // a patch made from a full file also depends on the base
+        if (resident) mods[i].residentPatch = resident->Get(resident->patches, modPaths[i].first.string() + '|' + fileName, packStamp(modPaths[i].first) + '|' + baseStamp);
+        if (mods[i].residentPatch) continue;
+        mz_zip_archive_file_stat modStat;
+        if (modPaths[i].second) {
+            entries.emplace_back(modPacks[i].get(), fileName + binaryPatchExt);
+            entries.emplace_back(modPacks[i].get(), fileName + patchExt);
+        }
+        else if (useCache && getFileStat(*modPacks[i], fileName, modStat)) {
+            mods[i].cachedPatchPath = getPatchCachePath(cachePath, fileName, modStat, baseStat, rules);
+            if (!std::filesystem::exists(mods[i].cachedPatchPath)) entries.emplace_back(modPacks[i].get(), fileName);
+        }
+        else {
+            entries.emplace_back(modPacks[i].get(), fileName);
+        }
+    }
+    {
+        TimingScope timing(TimingPhase::EXTRACT);
+        RBPackReader::ReadEntries(entries);
+    }
+
+    // tasks can run nested in tasks of other files on the same thread
+    auto inFile = [&fileName](const std::function<void()>& task) {
+        std::string previousFile = Timings::CurrentFile();
+        Timings::SetFile(fileName);
+        task();
+        Timings::SetFile(previousFile);
+    };
+
+    auto readBase = [&]() {
+        if (baseReseachFile) {
+            if (verbose) baseOut << "Using base file kept from the previous merge." << std::endl;
+        }
+        else {
+            if (verbose) baseOut << "Reading base pack." << std::endl;
+            try {
+                baseReseachFile = readRBFile(basePack, fileName);
+            }
+            catch (const std::exception& e) {
+                baseErr << "ERROR: Failed to parse base pack: " << e.what() << std::endl;
+                baseFailed = true;
+                return;
+            }
+            {
+                // hash the base once, every full copy mod is diffed against it
+                TimingScope timing(TimingPhase::PARSE, basePath.filename().string());
+                baseReseachFile->UpdateHashes(rules);
+            }
+            if (resident) resident->Set(resident->bases, basePath.string() + '|' + fileName, baseStamp, baseReseachFile);
+        }
+        TimingScope timing(TimingPhase::MERGE);
+        mergeFile = baseReseachFile->Copy();
+    };
+
+    auto readMod = [&](size_t i) {
+        ModRead& mod = mods[i];
+        std::filesystem::path modPackPath = modPaths[i].first;
+        std::string modPackName = modPackPath.filename().string();
+        bool isPatchFile = modPaths[i].second;
+        auto start = std::chrono::steady_clock::now();
+        if (isPatchFile) ++mod.cost.patchFiles; else ++mod.cost.fullFiles;
+
+        if (mod.residentPatch) {
+            // the merge can take over nodes of the patch, the kept one stays untouched
+            mod.modFile = mod.residentPatch->Copy();
+            mod.isResident = true;
+            if (verbose) mod.out << "Using patch kept from the previous merge for mod pack '" << modPackPath.filename() << "'." << std::endl;
+        }
+
+        if (!mod.modFile && !mod.cachedPatchPath.empty()) {
+            TimingScope timing(TimingPhase::PARSE, modPackName);
+            mod.modFile = readCachedPatch(mod.cachedPatchPath, mod.err);
+            if (mod.modFile) ++mod.cost.cachedFiles;
+            if (mod.modFile && verbose) mod.out << "Using cached patch file for mod pack '" << modPackPath.filename() << "'." << std::endl;
+        }
+
+        if (!mod.modFile && isPatchFile) {
+            mod.modFile = readBinaryPatchFile(*modPacks[i], fileName, rules, mod.err, &mod.cost.bytesExtracted);
+            if (mod.modFile && verbose) mod.out << "Using binary patch file from mod pack '" << modPackPath.filename() << "'." << std::endl;
+        }
+
+        if (!mod.modFile) {
+            if (verbose) mod.out << "Reading " << (isPatchFile ? "patch file" : "base file") << " from mod pack '" << modPackPath.filename() << "'." << std::endl;
+            std::string modFileName = isPatchFile ? fileName + patchExt : fileName;
+            try {
+                mod.modFile = readRBFile(*modPacks[i], modFileName, &mod.cost.bytesExtracted);
+            }
+            catch (const std::exception& e) {
+                mod.err << "ERROR: Failed to parse mod pack: " << e.what() << std::endl;
+                mod.failed = true;
+            }
+            if (mod.modFile && ModCostReport::Enabled()) mod.cost.nodesParsed = mod.modFile->GetMemoryStats().NumNodes();
+            mod.needsDiff = mod.modFile && !isPatchFile;
+        }
+        mod.time = std::chrono::steady_clock::now() - start;
+    };
+
+    auto diffMod = [&](size_t i) {
+        ModRead& mod = mods[i];
+        std::string modPackName = modPaths[i].first.filename().string();
+        auto start = std::chrono::steady_clock::now();
+        if (mod.needsDiff && !baseFailed) {
+            if (verbose) mod.out << "Creating patch file." << std::endl;
+            std::map<std::string, size_t> removedCounts;
+            {
+                TimingScope timing(TimingPhase::REMOVE_EQUAL, modPackName);
+                removedCounts = mod.modFile->RemoveEqual(baseReseachFile, rules);
+            }
+            if (verbose) printRemovedCounts(removedCounts, mod.out);
+            if (!mod.cachedPatchPath.empty()) {
+                TimingScope timing(TimingPhase::WRITE, modPackName);
+                writeCachedPatch(mod.cachedPatchPath, mod.modFile, mod.err);
+            }
+        }
+        if (mod.modFile && !baseFailed) {
+            if (ModCostReport::Enabled()) {
+                mod.cost.nodesMerged = mod.modFile->GetMemoryStats().NumNodes();
+                // cached and binary patches are read as they are
+                if (mod.cost.nodesParsed == 0) mod.cost.nodesParsed = mod.cost.nodesMerged;
+                mod.cost.nodesRemoved = mod.cost.nodesParsed - mod.cost.nodesMerged;
+            }
+            if (resident && !mod.isResident) {
+                resident->Set(resident->patches, modPaths[i].first.string() + '|' + fileName, packStamp(modPaths[i].first) + '|' + baseStamp, mod.modFile->Copy());
+            }
+        }
+        mod.time += std::chrono::steady_clock::now() - start;
+    };
+
+    TaskGroup* group = nullptr;
+    // runs a stage as a task, or right away without a scheduler
+    auto run = [&](std::function<void()> task) {
+        if (group) {
+            group->Run([&inFile, task]() { inFile(task); });
+        }
+        else {
+            task();
+        }
+    };
+    auto finishMod = [&](size_t i) {
+        try {
+            diffMod(i);
+        }
+        catch (const std::exception& e) {
+            mods[i].err << "ERROR: Failed to create patch: " << e.what() << std::endl;
+            mods[i].failed = true;
+        }
+        mods[i].done = true;
+        // wakes the merging thread if it sleeps on this mod
+        if (group) scheduler->Notify();
+    };
+    auto startMod = [&](size_t i) {
+        run([&, i]() {
+            try {
+                readMod(i);
+            }
+            catch (const std::exception& e) {
+                mods[i].err << "ERROR: Failed to read mod pack: " << e.what() << std::endl;
+                mods[i].failed = true;
+            }
+            if (--mods[i].waiting == 0) finishMod(i);
+        });
+    };
+
+    std::unique_ptr<TaskGroup> taskGroup;
+    if (scheduler && scheduler->NumThreads() > 1) {
+        taskGroup = std::make_unique<TaskGroup>(scheduler);
+        group = taskGroup.get();
+    }
+    size_t readAhead = group ? scheduler->NumThreads() * 2 : 1;
+    size_t nextMod = 0;
+    run([&]() {
+        try {
+            readBase();
+        }
+        catch (const std::exception& e) {
+            baseErr << "ERROR: Failed to read base pack: " << e.what() << std::endl;
+            baseFailed = true;
+        }
+        for (size_t i = 0; i < mods.size(); ++i) {
+            if (--mods[i].waiting == 0) run([&finishMod, i]() { finishMod(i); });
+        }
+    });
+    while (nextMod < std::min(readAhead, mods.size())) {
+        startMod(nextMod++);
+    }
+
+    std::vector<std::shared_ptr<RBFile>> modFiles;
+    std::vector<ModCost> modCosts;
+    bool failed = false;
+    for (size_t i = 0; i < mods.size() && !failed; ++i) {
+        while (!mods[i].done) {
+            // the mods are only done once the base is read as well
+            if (!scheduler->RunOne()) scheduler->WaitForWork([&mods, i]() { return mods[i].done.load(); });
+        }
+        if (nextMod < mods.size()) {
+            startMod(nextMod++);
+        }
+        if (i == 0) {
+            out << baseOut.str();
+            err << baseErr.str();
+            if (baseFailed) {
+                failed = true;
+                break;
+            }
+        }
+        out << mods[i].out.str();
+        err << mods[i].err.str();
+        failed = mods[i].failed;
+        if (!failed) {
+            mods[i].cost.seconds = std::chrono::duration<double>(mods[i].time).count();
+            modCosts.push_back(mods[i].cost);
+            modFiles.push_back(mods[i].modFile);
+        }
+    }
+    if (group) group->Wait();
+    if (failed) {
+        return MergeStatus::FAILED;
+    }
+
+    if (MemoryReport::Enabled()) {
+        // all trees that are alive at the same time while merging
+        MemoryReport::RecordTree(fileName, basePath.filename().string(), baseReseachFile->GetMemoryStats());
+        MemoryReport::RecordTree(fileName, "copy of base", mergeFile->GetMemoryStats());
+        for (size_t i = 0; i < modFiles.size(); ++i) {
+            MemoryReport::RecordTree(fileName, modPaths[i].first.filename().string(), modFiles[i]->GetMemoryStats());
+        }
+    }
+
+    // all patches are applied in load order in a single pass over the base
+    if (verbose) out << "Updating with " << modFiles.size() << " patch files." << std::endl;
+    auto mergeStart = std::chrono::steady_clock::now();
+    try {
+        TimingScope timing(TimingPhase::MERGE);
+        mergeFile->MergeAll(modFiles, rules);
+    }
+    catch (const std::exception& e) {
+        err << "ERROR: Failed to merge: " << e.what() << std::endl;
+        return MergeStatus::FAILED;
+    }
+    if (ModCostReport::Enabled()) {
+        // the single merge pass is shared by all mods, split its time by the nodes each one adds
+        double mergeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - mergeStart).count();
+        size_t totalMerged = 0;
+        for (const auto& cost : modCosts) {
+            totalMerged += cost.nodesMerged;
+        }
+        for (size_t i = 0; i < modCosts.size(); ++i) {
+            if (totalMerged > 0) modCosts[i].seconds += mergeSeconds * modCosts[i].nodesMerged / totalMerged;
+            ModCostReport::Record(modPaths[i].first.filename().string(), fileName, modCosts[i]);
+        }
+    }
+
+    if (resident) resident->Set(resident->merged, fileName, mergedStamp, mergeFile);
+    mergedFile = mergeFile;
+    return MergeStatus::OK;
+}
+
+std::pair<MergeStatus, std::shared_ptr<RBFile>> createPatchFile(const std::filesystem::path& packPath, const std::string& fileName, const std::string& modPackName, std::shared_ptr<RBMergeRules> rules, PackReaders& readers, std::ostream& out, std::ostream& err, const bool verbose) {
+    
+    std::filesystem::path modPackPath = std::filesystem::path(packPath).append(modPackName);
+    Timings::SetFile(fileName);
+    TraceScope trace("file", fileName);
+    std::filesystem::path basePath;
+    {
+        TimingScope timing(TimingPhase::DISCOVERY);
+        if (!archiveHasFile(readers.Get(modPackPath), fileName, err)) {
+            if(verbose) out << "File " << fileName << " is not modified." << std::endl;
+            return std::pair(MergeStatus::NOOP, nullptr);
+        }
+    
+        if (verbose) out << "Creating patch for file '" << fileName << "':" << std::endl;
+
+        basePath = getBaseArchiveForFile(packPath, fileName, readers, err);
+    }
+    if (basePath.empty()) {
+        err << "ERROR: Could not find base pack for file " << fileName << "." << std::endl;
+        return std::pair(MergeStatus::FAILED, nullptr);
+    }
+    if (verbose) out << "Found latest base file in " << basePath << std::endl;
+
+    if (verbose) out << "Reading base file." << std::endl;
+    std::shared_ptr<RBFile> baseFile;
+    try {
+        baseFile = readRBFile(readers.Get(basePath), fileName);
+    }
+    catch (const std::exception& e) {
+        err << "ERROR: Failed to parse base file: " << e.what() << std::endl;
+        return std::pair(MergeStatus::FAILED, nullptr);
+    }
+    {
+        TimingScope timing(TimingPhase::PARSE, basePath.filename().string());
+        baseFile->UpdateHashes(rules);
+    }
+
+    if (verbose) out << "Reading file from mod pack '" << modPackPath.filename() << "'." << std::endl;
+    std::shared_ptr<RBFile> modFile;
+    try {
+        //modFiles.push_back(readResearchFile(modPack, researchFile));
+        modFile = readRBFile(readers.Get(modPackPath), fileName);
+    }
+    catch (const std::exception& e) {
+        err << "ERROR: Failed to parse mod pack: " << e.what() << std::endl;
+        return std::pair(MergeStatus::FAILED, nullptr);
+    }
+
+    if (MemoryReport::Enabled()) {
+        MemoryReport::RecordTree(fileName, basePath.filename().string(), baseFile->GetMemoryStats());
+        MemoryReport::RecordTree(fileName, modPackName, modFile->GetMemoryStats());
+    }
+
+    if (verbose) out << "Creating patch file." << std::endl;
+    try {
+        std::map<std::string, size_t> removedCounts;
+        {
+            TimingScope timing(TimingPhase::REMOVE_EQUAL, modPackName);
+            removedCounts = modFile->RemoveEqual(baseFile, rules);
+        }
+        if (verbose) printRemovedCounts(removedCounts, out);
+    }
+    catch (const std::exception& e) {
+        err << "ERROR: Failed to create patch: " << e.what() << std::endl;
+        return std::pair(MergeStatus::FAILED, nullptr);
+    }
+
+    return std::pair(MergeStatus::OK, modFile);
+}
+
+// writes the text patch files and their binary versions, if any
+bool writePatchFiles(mz_zip_archive* archive, const std::map<std::string, std::shared_ptr<RBFile>>& patchFiles, const std::map<std::string, std::string>& binaryPatches, const std::string& packName, std::ostream& out, std::ostream& err, const bool verbose) {
+    for (const auto& [filename, file] : patchFiles) {
+        if (verbose) out << "Write new patch file: " << filename << std::endl;
+        if (!writeRBFileToArchive(archive, filename, file))
+        {
+            err << "Failed to write new patch file " << filename << " to pack " << packName << ": " << archive->m_last_error << std::endl;
+            return false;
+        }
+    }
+    for (const auto& [filename, data] : binaryPatches) {
+        if (verbose) out << "Write new binary patch file: " << filename << std::endl;
+        if (!mz_zip_writer_add_mem(archive, filename.c_str(), data.data(), data.size(), MZ_BEST_COMPRESSION))
+        {
+            err << "Failed to write new patch file " << filename << " to pack " << packName << ": " << archive->m_last_error << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// zip record layout, not exported by miniz
+const mz_uint32 zipCentralDirHeaderSig = 0x02014b50;
+const mz_uint32 zipCentralDirHeaderSize = 46;
+const mz_uint32 zipCentralDirFilenameLenOfs = 28;
+const mz_uint32 zipCentralDirExtraLenOfs = 30;
+const mz_uint32 zipCentralDirCommentLenOfs = 32;
+const mz_uint32 zipEndOfCentralDirSig = 0x06054b50;
+const mz_uint32 zipEndOfCentralDirSize = 22;
+const mz_uint32 zipEndOfCentralDirCommentLenOfs = 20;
+
+// Output of the zip writer used by replaceTailPatches. The new entries and their central directory are built
+// in memory, the pack is only written once everything that can fail before has succeeded.
+struct TailWriter {
+    // offset of the first byte of data in the pack
+    mz_uint64 startOffset = 0;
+    std::vector<char> data;
+};
+
+size_t writeTail(void* opaque, mz_uint64 fileOffset, const void* data, size_t length) {
+    TailWriter* writer = static_cast<TailWriter*>(opaque);
+    if (fileOffset < writer->startOffset) {
+        return 0;
+    }
+    size_t pos = (size_t)(fileOffset - writer->startOffset);
+    if (pos + length > writer->data.size()) {
+        writer->data.resize(pos + length);
+    }
+    memcpy(writer->data.data() + pos, data, length);
+    return length;
+}
+
+void appendLE16(std::vector<char>& out, mz_uint32 value) {
+    out.push_back((char)(value & 0xFF));
+    out.push_back((char)((value >> 8) & 0xFF));
+}
+
+void appendLE32(std::vector<char>& out, mz_uint32 value) {
+    appendLE16(out, value & 0xFFFF);
+    appendLE16(out, value >> 16);
+}
+
+// writes data at offset and cuts the file off behind it
+bool writeTailToFile(const std::filesystem::path& archivePath, mz_uint64 offset, const std::vector<char>& data) {
+    {
+        std::fstream file(archivePath, std::ios::in | std::ios::out | std::ios::binary);
+        if (!file) {
+            return false;
+        }
+        file.seekp(offset);
+        file.write(data.data(), data.size());
+        file.close();
+        if (file.fail()) {
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::resize_file(archivePath, offset + data.size(), error);
+    return !error;
+}
+
+// Writes the new patch files over old ones if all old patch files are at the end of the pack,
+// so the other entries, usually large textures, don't have to be copied.
+// Returns NOOP and leaves the reader open if the pack has to be copied instead, otherwise the reader is closed.
+// If writing the pack fails, the old patch files and central directory are written back.
+MergeStatus replaceTailPatches(const std::filesystem::path& archivePath, mz_zip_archive& zip_archive, std::map<std::string, std::shared_ptr<RBFile>>& patchFiles, const std::map<std::string, std::string>& binaryPatches, std::ostream& out, std::ostream& err, const bool verbose) {
+    if (mz_zip_is_zip64(&zip_archive)) {
+        return MergeStatus::NOOP;
+    }
+
+    mz_uint numFiles = mz_zip_reader_get_num_files(&zip_archive);
+    mz_zip_archive_file_stat zip_file_stat;
+    std::vector<mz_uint64> keptCentralDirOffsets;
+    mz_uint64 keptEnd = 0;
+    mz_uint64 truncateOffset = UINT64_MAX;
+    for (mz_uint i = 0; i < numFiles; ++i) {
+        if (!mz_zip_reader_file_stat(&zip_archive, i, &zip_file_stat)) {
+            return MergeStatus::NOOP;
+        }
+        std::string filename(zip_file_stat.m_filename);
+        if (filename.find(patchExt) == std::string::npos) {
+            keptCentralDirOffsets.push_back(zip_file_stat.m_central_dir_ofs);
+            keptEnd = std::max(keptEnd, zip_file_stat.m_local_header_ofs);
+        }
+        else {
+            truncateOffset = std::min(truncateOffset, zip_file_stat.m_local_header_ofs);
+        }
+    }
+    if (keptEnd >= truncateOffset) {
+        if (verbose) out << "Old patch files are followed by other files." << std::endl;
+        return MergeStatus::NOOP;
+    }
+    if (keptCentralDirOffsets.size() + patchFiles.size() + binaryPatches.size() >= MZ_UINT16_MAX) {
+        return MergeStatus::NOOP;
+    }
+
+    // the old patch files and central directory, kept to be written back if the pack can not be updated
+    std::ifstream in(archivePath, std::ios::binary);
+    in.seekg(0, std::ios::end);
+    mz_uint64 fileSize = in.tellg();
+    mz_uint64 centralDirOffset = zip_archive.m_central_directory_file_ofs;
+    if (truncateOffset > centralDirOffset || centralDirOffset > fileSize) {
+        return MergeStatus::NOOP;
+    }
+    std::vector<char> oldTail(fileSize - truncateOffset);
+    in.seekg(truncateOffset);
+    in.read(oldTail.data(), oldTail.size());
+    if (!in) {
+        return MergeStatus::NOOP;
+    }
+    in.close();
+    const char* oldCentralDir = oldTail.data() + (centralDirOffset - truncateOffset);
+    mz_uint64 oldCentralDirSize = fileSize - centralDirOffset;
+
+    // the end of central directory record is followed by the archive comment, which is kept
+    mz_uint64 endOfCentralDir = UINT64_MAX;
+    for (mz_uint64 pos = oldCentralDirSize >= zipEndOfCentralDirSize ? oldCentralDirSize - zipEndOfCentralDirSize + 1 : 0; pos-- > 0;) {
+        const mz_uint8* record = reinterpret_cast<const mz_uint8*>(oldCentralDir) + pos;
+        if (MZ_READ_LE32(record) == zipEndOfCentralDirSig && pos + zipEndOfCentralDirSize + MZ_READ_LE16(record + zipEndOfCentralDirCommentLenOfs) == oldCentralDirSize) {
+            endOfCentralDir = pos;
+            break;
+        }
+    }
+    if (endOfCentralDir == UINT64_MAX) {
+        return MergeStatus::NOOP;
+    }
+    std::vector<char> comment(oldCentralDir + endOfCentralDir + zipEndOfCentralDirSize, oldCentralDir + oldCentralDirSize);
+
+    // central directory records of the kept files are reused as they are
+    std::vector<char> centralDir;
+    for (mz_uint64 offset : keptCentralDirOffsets) {
+        const mz_uint8* record = reinterpret_cast<const mz_uint8*>(oldCentralDir) + offset;
+        if (offset + zipCentralDirHeaderSize > endOfCentralDir || MZ_READ_LE32(record) != zipCentralDirHeaderSig) {
+            return MergeStatus::NOOP;
+        }
+        mz_uint64 recordSize = zipCentralDirHeaderSize + MZ_READ_LE16(record + zipCentralDirFilenameLenOfs)
+            + MZ_READ_LE16(record + zipCentralDirExtraLenOfs) + MZ_READ_LE16(record + zipCentralDirCommentLenOfs);
+        if (offset + recordSize > endOfCentralDir) {
+            return MergeStatus::NOOP;
+        }
+        centralDir.insert(centralDir.end(), oldCentralDir + offset, oldCentralDir + offset + recordSize);
+    }
+
+    // the new entries are written behind the kept ones
+    std::string path = archivePath.string();
+    TailWriter tail;
+    tail.startOffset = truncateOffset;
+    mz_zip_archive out_archive;
+    memset(&out_archive, 0, sizeof(out_archive));
+    out_archive.m_pWrite = writeTail;
+    out_archive.m_pIO_opaque = &tail;
+    if (!mz_zip_writer_init_v2(&out_archive, truncateOffset, 0)) {
+        err << "Failed to initialize writer for pack " << path << ": " << out_archive.m_last_error << std::endl;
+        mz_zip_reader_end(&zip_archive);
+        return MergeStatus::FAILED;
+    }
+    if (!writePatchFiles(&out_archive, patchFiles, binaryPatches, path, out, err, verbose)) {
+        mz_zip_writer_end(&out_archive);
+        mz_zip_reader_end(&zip_archive);
+        return MergeStatus::FAILED;
+    }
+    mz_uint64 newCentralDirOffset = out_archive.m_archive_size;
+    mz_bool status = mz_zip_writer_finalize_archive(&out_archive);
+    mz_zip_writer_end(&out_archive);
+    if (!status || tail.data.size() < newCentralDirOffset - truncateOffset + zipEndOfCentralDirSize)
+    {
+        err << "Failed to finalize pack " << path << ": " << out_archive.m_last_error << std::endl;
+        mz_zip_reader_end(&zip_archive);
+        return MergeStatus::FAILED;
+    }
+
+    // new records without their end of central directory record, followed by one covering all files
+    centralDir.insert(centralDir.end(), tail.data.begin() + (size_t)(newCentralDirOffset - truncateOffset), tail.data.end() - zipEndOfCentralDirSize);
+    tail.data.resize((size_t)(newCentralDirOffset - truncateOffset));
+    mz_uint32 totalFiles = (mz_uint32)(keptCentralDirOffsets.size() + patchFiles.size() + binaryPatches.size());
+    mz_uint64 centralDirSize = centralDir.size();
+    if (newCentralDirOffset + centralDirSize > MZ_UINT32_MAX) {
+        if (verbose) out << "Pack is too large to update in place." << std::endl;
+        return MergeStatus::NOOP;
+    }
+    appendLE32(centralDir, zipEndOfCentralDirSig);
+    appendLE16(centralDir, 0);
+    appendLE16(centralDir, 0);
+    appendLE16(centralDir, totalFiles);
+    appendLE16(centralDir, totalFiles);
+    appendLE32(centralDir, (mz_uint32)centralDirSize);
+    appendLE32(centralDir, (mz_uint32)newCentralDirOffset);
+    appendLE16(centralDir, (mz_uint32)comment.size());
+    centralDir.insert(centralDir.end(), comment.begin(), comment.end());
+    tail.data.insert(tail.data.end(), centralDir.begin(), centralDir.end());
+
+    mz_zip_reader_end(&zip_archive);
+    if (verbose) out << "Replace old patch files at the end of the mod pack." << std::endl;
+    if (!std::fstream(archivePath, std::ios::in | std::ios::out | std::ios::binary)) {
+        err << "Failed to open pack " << path << " for writing." << std::endl;
+        return MergeStatus::FAILED;
+    }
+    if (!writeTailToFile(archivePath, truncateOffset, tail.data)) {
+        if (writeTailToFile(archivePath, truncateOffset, oldTail)) {
+            err << "Failed to write patch files to pack " << path << ", the pack was left unchanged." << std::endl;
+        }
+        else {
+            err << "Failed to write patch files to pack " << path << " and to restore its old patch files, the pack is damaged." << std::endl;
+        }
+        return MergeStatus::FAILED;
+    }
+    return MergeStatus::OK;
+}
+
+bool updatePatchesInPack(const std::filesystem::path& archivePath, std::map<std::string, std::shared_ptr<RBFile>>& patchFiles, const std::map<std::string, std::string>& binaryPatches, std::ostream& out, std::ostream& err, const bool verbose) {
+    mz_zip_archive zip_archive;
+    memset(&zip_archive, 0, sizeof(zip_archive));
+    std::string path = archivePath.string();
+    mz_bool status = mz_zip_reader_init_file(&zip_archive, path.c_str(), 0);
+    if (!status)
+    {
+        err << "Failed to read pack " << archivePath << ": " << zip_archive.m_last_error << std::endl;
+        return false;
+    }
+
+    mz_zip_archive_file_stat zip_file_stat;
+    bool copy = false;
+    mz_uint numFiles = mz_zip_reader_get_num_files(&zip_archive);
+    if (verbose) out << "Checking for old patch files." << std::endl;
+    for (mz_uint i = 0; i < numFiles; ++i) {
+        memset(&zip_file_stat, 0, sizeof(zip_file_stat));
+        status = mz_zip_reader_file_stat(&zip_archive, i, &zip_file_stat);
+        if (!status)
+        {
+            err << "Failed to file stat from " << archivePath << ": " << zip_archive.m_last_error << std::endl;
+            return false;
+        }
+
+        std::string filename(zip_file_stat.m_filename);
+        if (filename.find(patchExt)!=std::string::npos) { // == (filename.length() - std::strlen(patchExt))
+            if (verbose) out << "Found patch file." << std::endl;
+            copy = true;
+            break;
+        }
+    }
+
+    if (copy) {
+        MergeStatus tailStatus = replaceTailPatches(archivePath, zip_archive, patchFiles, binaryPatches, out, err, verbose);
+        if (tailStatus != MergeStatus::NOOP) {
+            return tailStatus == MergeStatus::OK;
+        }
+    }
+
+    if (copy) {
+        //there are old patch files that need to be removed, so copy the other files to new archive
+        std::string tempPath = archivePath.string() + ".temp";
+        if (verbose) out << "Copy to temporary pack." << tempPath << std::endl;
+
+        mz_zip_archive out_archive;
+        memset(&out_archive, 0, sizeof(out_archive));
+        status = mz_zip_writer_init_file(&out_archive, tempPath.c_str(), 0);
+        if (!status)
+        {
+            err << "Failed initialize temporary pack " << tempPath << ": " << zip_archive.m_last_error << std::endl;
+            return false;
+        }
+
+        for (mz_uint i = 0; i < numFiles; ++i) {
+            memset(&zip_file_stat, 0, sizeof(zip_file_stat));
+            status = mz_zip_reader_file_stat(&zip_archive, i, &zip_file_stat);
+            if (!status)
+            {
+                err << "Failed to file stat from " << archivePath << ": " << zip_archive.m_last_error << std::endl;
+                return false;
+            }
+
+            std::string filename(zip_file_stat.m_filename);
+            if (filename.find(patchExt) == std::string::npos) {
+                if (verbose) out << "Copy file: " << filename << std::endl;
+                status = mz_zip_writer_add_from_zip_reader(&out_archive, &zip_archive, i);
+                if (!status)
+                {
+                    err << "Failed to copy file " << filename << " to temporary pack " << tempPath << ": " << zip_archive.m_last_error << std::endl;
+                    return false;
+                }
+            }
+            else {
+                if (verbose) out << "Ignore old patch file: " << filename << std::endl;
+            }
+        }
+
+        if (!writePatchFiles(&out_archive, patchFiles, binaryPatches, tempPath, out, err, verbose)) {
+            return false;
+        }
+
+        if (verbose) out << "Finalize temporary pack." << std::endl;
+        status = mz_zip_reader_end(&zip_archive);
+        status = mz_zip_writer_finalize_archive(&out_archive);
+        if (!status)
+        {
+            err << "Failed to finalize temporary pack " << tempPath << ": " << zip_archive.m_last_error << std::endl;
+            return false;
+        }
+        status = mz_zip_writer_end(&out_archive);
+
+        if (verbose) out << "Remove old mod pack." << std::endl;
+        std::filesystem::remove(archivePath);
+        if (verbose) out << "Rename temporary pack." << std::endl;
+        std::filesystem::rename(tempPath, archivePath);
+    }
+    else {
+        if (verbose) out << "Write patches to mod pack." << std::endl;
+        status = mz_zip_writer_init_from_reader(&zip_archive, path.c_str());
+
+        if (!writePatchFiles(&zip_archive, patchFiles, binaryPatches, path, out, err, verbose)) {
+            return false;
+        }
+
+
+        if (verbose) out << "Finalize mod pack." << std::endl;
+        status = mz_zip_writer_finalize_archive(&zip_archive);
+        if (!status)
+        {
+            err << "Failed to finalize pack " << path << ": " << zip_archive.m_last_error << std::endl;
+            return false;
+        }
+        status = mz_zip_writer_end(&zip_archive);
+    }
+
+    return true;
+}
+
+std::string RBMergeResult::Text(const std::string& file, bool errors) const {
+    std::string text;
+    for (const auto& message : messages) {
+        if (message.file == file && message.isError == errors) {
+            text += message.text;
+        }
+    }
+    return text;
+}
+
+// moves what was written to out and err into the messages of the result, in this order
+void addMessages(RBMergeResult& result, const std::string& file, std::stringstream& out, std::stringstream& err) {
+    for (auto* stream : { &out, &err }) {
+        std::string text = stream->str();
+        if (!text.empty()) {
+            result.messages.push_back({ file, stream == &err, text });
+        }
+        stream->str(std::string());
+    }
+}
+
+RBMergeSession::RBMergeSession(const std::filesystem::path& packPath, std::shared_ptr<RBMergeRegistry> registry)
+    : m_packPath(packPath), m_registry(registry), m_resident(std::make_unique<ResidentTrees>()) {
+    if (!std::filesystem::is_directory(packPath)) {
+        std::stringstream ss;
+        ss << "Pack folder " << packPath << " does not exist.";
+        throw std::runtime_error(ss.str());
+    }
+}
+
+RBMergeSession::~RBMergeSession() = default;
+
+void RBMergeSession::SetCachePath(const std::filesystem::path& cachePath) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cachePath = cachePath;
+}
+
+void RBMergeSession::SetVerbose(bool verbose) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_verbose = verbose;
+}
+
+void RBMergeSession::SetKeepTrees(bool keepTrees) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_keepTrees = keepTrees;
+    if (!keepTrees) {
+        m_resident = std::make_unique<ResidentTrees>();
+    }
+}
+
+std::map<std::string, std::string> RBMergeSession::GetPackStamps(const std::string& mergedPackName) const {
+    std::regex archiveMask(".+.zip$", std::regex_constants::icase);
+    std::map<std::string, std::string> stamps;
+    for (const auto& file : std::filesystem::directory_iterator(m_packPath)) {
+        std::string archiveName = file.path().filename().string();
+        if (!file.is_directory() && archiveName != mergedPackName && std::regex_search(archiveName, archiveMask)) {
+            stamps.emplace(archiveName, packStamp(file.path()));
+        }
+    }
+    return stamps;
+}
+
+// the catalog of the last request, read again if any pack changed since
+const PackCatalog& RBMergeSession::Catalog(const std::string& mergedPackName, std::ostream& err) {
+    TimingScope timing(TimingPhase::DISCOVERY);
+    auto stamps = GetPackStamps(mergedPackName);
+    if (!m_catalog || mergedPackName != m_catalogMergedPack || stamps != m_catalogStamps) {
+        m_catalog = std::make_unique<PackCatalog>(readPackCatalog(m_packPath, mergedPackName, m_cachePath, err));
+        m_catalogMergedPack = mergedPackName;
+        m_catalogStamps = stamps;
+    }
+    return *m_catalog;
+}
+
+RBMergeResult RBMergeSession::Merge(const std::string& mergedPackName) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    RBMergeResult result;
+    std::stringstream out;
+    std::stringstream err;
+
+    std::filesystem::path mergedPath = std::filesystem::path(m_packPath).append(mergedPackName);
+
+    // the old merged pack stays in place until the new one is complete
+    MergedPack mergedPack;
+    if (!openMergedPack(mergedPack, mergedPath, err)) {
+        addMessages(result, std::string(), out, err);
+        return result;
+    }
+
+    ResidentTrees* resident = m_keepTrees ? m_resident.get() : nullptr;
+    if (resident) ++resident->run;
+    const PackCatalog& catalog = Catalog(mergedPackName, err);
+    auto files = m_registry->Files(getModifiedFiles(catalog));
+    // without a base there is nothing to merge into, exact file names of the rules fail for the missing base instead
+    std::set<std::string> listedFiles;
+    for (const auto& file : files) {
+        listedFiles.insert(file.first);
+    }
+    for (const auto& [file, packs] : getConflictsWithoutBase(catalog)) {
+        if (listedFiles.count(file) == 0 && m_registry->Find(file)) {
+            err << "WARNING: '" << file << "' is in no base pack and is added by " << packs.size() << " mod packs, it is not merged:";
+            for (const auto& pack : packs) {
+                err << " " << pack.filename().string();
+            }
+            err << std::endl;
+        }
+    }
+    addMessages(result, std::string(), out, err);
+
+    // files are merged in parallel and added to the merged pack in rule order, a window
+    // of a few files per thread bounds the number of merged trees held at the same time
+    struct FileMerge {
+        MergeStatus status = MergeStatus::FAILED;
+        std::shared_ptr<RBFile> merged;
+        std::stringstream out;
+        std::stringstream err;
+    };
+    std::shared_ptr<TaskScheduler> scheduler = TaskScheduler::Global();
+    size_t window = scheduler ? scheduler->NumThreads() * 2 : 1;
+    for (size_t start = 0; start < files.size(); start += window) {
+        size_t count = std::min(window, files.size() - start);
+        std::vector<FileMerge> merges(count);
+        auto mergeOne = [&](size_t i) {
+            const auto& [file, rules] = files[start + i];
+            // the task can run nested inside another file's merge on this thread
+            std::string previousFile = Timings::CurrentFile();
+            try {
+                merges[i].status = createMergeFile(catalog, file, rules, m_cachePath, resident, merges[i].merged, merges[i].out, merges[i].err, m_verbose);
+            }
+            catch (const std::exception& e) {
+                merges[i].err << "ERROR: Failed to merge '" << file << "': " << e.what() << std::endl;
+            }
+            Timings::SetFile(previousFile);
+        };
+        if (scheduler && count > 1) {
+            TaskGroup group(scheduler);
+            for (size_t i = 0; i < count; ++i) {
+                group.Run([&mergeOne, i]() { mergeOne(i); });
+            }
+            group.Wait();
+        }
+        else {
+            for (size_t i = 0; i < count; ++i) {
+                mergeOne(i);
+            }
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            const std::string& file = files[start + i].first;
+            if (merges[i].status == MergeStatus::OK && merges[i].merged) {
+                Timings::SetFile(file);
+                if (!addMergedFile(mergedPack, file, merges[i].merged, merges[i].err)) {
+                    merges[i].status = MergeStatus::FAILED;
+                }
+            }
+            if (merges[i].status == MergeStatus::FAILED) {
+                ++result.numFailed;
+            }
+            result.files.push_back({ file, merges[i].status });
+            addMessages(result, file, merges[i].out, merges[i].err);
+        }
+    }
+    if (resident) resident->Prune();
+
+    try
+    {
+        Timings::SetFile(mergedPackName);
+        TimingScope timing(TimingPhase::WRITE);
+        result.changed = closeMergedPack(mergedPack);
+    }
+    catch (const std::exception& e)
+    {
+        err << "ERROR: Failed to write merged pack:\n\t" << e.what() << std::endl;
+        addMessages(result, std::string(), out, err);
+        return result;
+    }
+
+    out << std::endl;
+    if (result.numFailed > 0) {
+        out << result.numFailed << " of " << result.files.size() << " FAILED to merge." << std::endl;
+    }
+    else {
+        out << "All " << result.files.size() << " files merged SUCCESSFULLY." << std::endl;
+    }
+    if (!result.changed) {
+        out << "Merged pack " << mergedPath << " is already up to date, left unchanged." << std::endl;
+    }
+    addMessages(result, std::string(), out, err);
+    result.success = true;
+    return result;
+}
+
+RBMergeResult RBMergeSession::CreatePatch(const std::string& modPackName, const std::string& mergedPackName, bool binaryPatch) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    RBMergeResult result;
+    std::stringstream out;
+    std::stringstream err;
+
+    std::filesystem::path modPackPath = std::filesystem::path(m_packPath).append(modPackName);
+    if (!std::filesystem::exists(modPackPath)) {
+        err << std::endl << "Mod pack  '" << modPackName << "' does not exist." << std::endl;
+        addMessages(result, std::string(), out, err);
+        return result;
+    }
+
+    out << std::endl << "Creating patch files for  '" << modPackName << "':" << std::endl;
+
+    std::set<std::string> modifiedFiles;
+    if (m_registry->HasPatterns()) {
+        modifiedFiles = getModifiedFiles(Catalog(mergedPackName, err));
+    }
+    addMessages(result, std::string(), out, err);
+
+    std::map<std::string, std::shared_ptr<RBFile>> patchFiles;
+    std::map<std::string, std::string> binaryPatches;
+    {
+        // the packs are closed again before the mod pack is written
+        PackReaders readers;
+        for (const auto& [file, rules] : m_registry->Files(modifiedFiles))
+        {
+            auto status = createPatchFile(m_packPath, file, modPackName, rules, readers, out, err, m_verbose);
+            if (status.first == MergeStatus::FAILED) {
+                ++result.numFailed;
+            }
+            else if (status.first == MergeStatus::OK) {
+                patchFiles.emplace(file + patchExt, status.second);
+                if (binaryPatch) {
+                    TimingScope timing(TimingPhase::SERIALIZE);
+                    // bound to the text patch by its checksum, the binary patch is ignored once the text is edited
+                    binaryPatches.emplace(file + binaryPatchExt, writeBinaryPatch(status.second, serializedCrc32(status.second), status.second->GetSerializedSize(), rules));
+                }
+            }
+            result.files.push_back({ file, status.first });
+            addMessages(result, file, out, err);
+        }
+    }
+
+    out << std::endl;
+    if (result.numFailed > 0) {
+        out << result.numFailed << " of " << result.files.size() << " FAILED to patch." << std::endl;
+    }
+    else {
+        out << "All " << result.files.size() << " files patched SUCCESSFULLY." << std::endl;
+    }
+
+    if (m_verbose) out << "Writing " << patchFiles.size() << " patches to mod pack." << std::endl;
+    Timings::SetFile(modPackName);
+    TimingScope timing(TimingPhase::WRITE, modPackName);
+    result.success = updatePatchesInPack(modPackPath, patchFiles, binaryPatches, out, err, m_verbose);
+    result.changed = result.success;
+    addMessages(result, std::string(), out, err);
+    return result;
+}
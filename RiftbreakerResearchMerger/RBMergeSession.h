@@ -0,0 +1,83 @@
+#pragma once
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "RBMergeRegistry.h"
+
+enum class MergeStatus {
+	OK = 0,
+	FAILED = 1,
+	NOOP = 2,
+};
+
+// Text written while handling a request, in the order it was written.
+struct RBMergeMessage {
+	// empty for messages about the whole request
+	std::string file;
+	bool isError;
+	std::string text;
+};
+
+struct RBMergeFileResult {
+	std::string file;
+	MergeStatus status;
+};
+
+struct RBMergeResult {
+	// false if the request failed as a whole, failed files are only counted in numFailed
+	bool success = false;
+	// the merged pack or the mod pack was written
+	bool changed = false;
+	size_t numFailed = 0;
+	std::vector<RBMergeFileResult> files;
+	std::vector<RBMergeMessage> messages;
+
+	// all messages or errors of a file, of the whole request for an empty file name
+	std::string Text(const std::string& file, bool errors) const;
+};
+
+struct PackCatalog;
+struct ResidentTrees;
+
+// Merge engine for a pack folder, used by the command line tool and by hosts like mod managers.
+// The pack catalog is read once and only again if a pack changed, the parsed trees of unchanged
+// packs are kept between requests. Requests are handled one at a time and can come from any thread.
+class RBMergeSession
+{
+public:
+	RBMergeSession(const std::filesystem::path& packPath, std::shared_ptr<RBMergeRegistry> registry);
+	~RBMergeSession();
+	RBMergeSession(const RBMergeSession&) = delete;
+	RBMergeSession& operator=(const RBMergeSession&) = delete;
+
+	// folder of the cached patches of full file mods, empty to disable the cache
+	void SetCachePath(const std::filesystem::path& cachePath);
+	void SetVerbose(bool verbose);
+	// keep parsed trees between requests, a single merge is faster and smaller without
+	void SetKeepTrees(bool keepTrees);
+	const std::filesystem::path& GetPackPath() const { return m_packPath; }
+
+	// merges the modified files of all mod packs into the merged pack in the pack folder
+	RBMergeResult Merge(const std::string& mergedPackName);
+	// writes minimal patches of the files modified by the mod pack into the mod pack,
+	// the merged pack is not a mod pack and left out when looking for modified files
+	RBMergeResult CreatePatch(const std::string& modPackName, const std::string& mergedPackName, bool binaryPatch);
+	// size and write time of every pack except the merged pack, by name
+	std::map<std::string, std::string> GetPackStamps(const std::string& mergedPackName) const;
+private:
+	const PackCatalog& Catalog(const std::string& mergedPackName, std::ostream& err);
+
+	std::filesystem::path m_packPath;
+	std::shared_ptr<RBMergeRegistry> m_registry;
+	std::filesystem::path m_cachePath;
+	bool m_verbose = false;
+	bool m_keepTrees = true;
+	std::unique_ptr<PackCatalog> m_catalog;
+	std::string m_catalogMergedPack;
+	std::map<std::string, std::string> m_catalogStamps;
+	std::unique_ptr<ResidentTrees> m_resident;
+	std::mutex m_mutex;
+};
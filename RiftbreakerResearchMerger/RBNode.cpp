@@ -3,8 +3,73 @@
 #include <iostream>
 #include <sstream>
 #include <map>
+#include <set>
+#include <mutex>
 #include <utility>
 #include "parser_utils.h"
+#include "TaskScheduler.h"
+
+static inline uint64_t mixHash(uint64_t h)
+{
+	// splitmix64 finalizer
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+static inline uint64_t combineHash(uint64_t seed, uint64_t value)
+{
+	return mixHash(seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2)));
+}
+
+static inline uint64_t stringHash(const std::string& s)
+{
+	return static_cast<uint64_t>(std::hash<std::string>{}(s));
+}
+
+uint64_t RBNode::GetHash(std::shared_ptr<RBMergeRules> rules) const
+{
+	if (m_hashRules != rules.get()) {
+		m_hash = ComputeHash(rules);
+		m_hashRules = rules.get();
+	}
+	return m_hash;
+}
+
+// heap buffer of a string, short strings are stored inline
+static size_t stringHeapBytes(const std::string& value)
+{
+	return value.capacity() > std::string().capacity() ? value.capacity() + 1 : 0;
+}
+
+// a make_shared allocation holds the object next to its control block (vtable pointer, use and weak count)
+static size_t sharedAllocationBytes(size_t objectSize)
+{
+	return objectSize + sizeof(void*) + 2 * sizeof(int);
+}
+
+void RBMemoryStats::Add(const RBMemoryStats& other)
+{
+	for (int i = 0; i < 3; ++i) {
+		nodes[i] += other.nodes[i];
+	}
+	nameBytes += other.nameBytes;
+	valueBytes += other.valueBytes;
+	controlBlocks += other.controlBlocks;
+	heapBytes += other.heapBytes;
+}
+
+const RBSerializedSize& RBNode::GetSerializedSize() const
+{
+	if (!m_sizeValid) {
+		m_size = ComputeSerializedSize();
+		m_sizeValid = true;
+	}
+	return m_size;
+}
 
 bool RBNodeList::Contains(std::shared_ptr<RBNode> node) const
 {
@@ -46,6 +111,7 @@ void RBNodeList::RemoveNode(std::shared_ptr<RBNode> node)
 {
 	auto it = std::find(m_nodes.begin(), m_nodes.end(), node);
 	m_nodes.erase(it);
+	InvalidateCache();
 }
 
 bool RBNodeList::IsDict() const
@@ -113,6 +179,23 @@ std::map<std::string, std::pair<size_t, std::shared_ptr<RBNode>>> RBNodeList::As
 {
 	std::map<std::string, std::pair<size_t, std::shared_ptr<RBNode>>> map;
 
+	std::vector<std::string> computedKeys;
+	const std::vector<std::string>* keys = &m_listKeys;
+	if (m_listKeyName.compare(keyName) != 0 || m_listKeys.size() != m_nodes.size()) {
+		computedKeys = ListKeys(keyName);
+		keys = &computedKeys;
+	}
+	for (size_t i = 0; i < m_nodes.size(); ++i) {
+		map.emplace((*keys)[i], std::pair<size_t, std::shared_ptr<RBNode>>(i, m_nodes[i]));
+	}
+	return map;
+}
+
+std::vector<std::string> RBNodeList::ListKeys(const std::string& keyName) const
+{
+	std::vector<std::string> keys;
+	keys.reserve(m_nodes.size());
+
 	std::shared_ptr<RBNode> node;
 	for (int i = 0; i < m_nodes.size(); ++i) {
 		node = m_nodes[i];
@@ -134,28 +217,41 @@ std::map<std::string, std::pair<size_t, std::shared_ptr<RBNode>>> RBNodeList::As
 			throw std::runtime_error(ss.str());
 		}
 		std::shared_ptr<RBNodeValue> valueNode = std::static_pointer_cast<RBNodeValue>(keyNote);
-		map.emplace(valueNode->GetValue(), std::pair<size_t, std::shared_ptr<RBNodeList>>(i, listNode));
+		keys.push_back(valueNode->GetValue());
 	}
-	return map;
+	return keys;
 }
 
 void RBNodeList::Merge(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules)
 {
-	if (other->GetName().compare(m_name) != 0) {
-		std::stringstream ss;
-		ss << "Attempt to merge '" << other->GetName() << "' with '" << m_name << "'.";
-		throw std::runtime_error(ss.str());
+	MergeAll(std::vector<std::shared_ptr<RBNode>>{ other }, rules);
+}
+
+void RBNodeList::MergeAll(const std::vector<std::shared_ptr<RBNode>>& others, std::shared_ptr<RBMergeRules> rules)
+{
+	if (others.empty()) {
+		return;
 	}
+	InvalidateCache();
 
-	if (other->GetType() != GetType()) {
-		throw std::runtime_error("Can't merge nodes with different types.");
+	std::vector<std::shared_ptr<RBNodeList>> otherLists;
+	for (const auto& other : others) {
+		if (other->GetName().compare(m_name) != 0) {
+			std::stringstream ss;
+			ss << "Attempt to merge '" << other->GetName() << "' with '" << m_name << "'.";
+			throw std::runtime_error(ss.str());
+		}
+
+		if (other->GetType() != GetType()) {
+			throw std::runtime_error("Can't merge nodes with different types.");
+		}
+		otherLists.push_back(std::static_pointer_cast<RBNodeList>(other));
 	}
 
-	auto otherList = std::static_pointer_cast<RBNodeList>(other);
-	std::shared_ptr<RBMergeRule> rule = rules->Get(m_name);
+	const std::shared_ptr<RBMergeRule>& rule = rules->Get(m_name);
 
 	std::map<std::string, std::pair<size_t, std::shared_ptr<RBNode>>> listMap;
-	std::map<std::string, std::pair<size_t, std::shared_ptr<RBNode>>> otherListMap;
+	std::vector<std::map<std::string, std::pair<size_t, std::shared_ptr<RBNode>>>> otherListMaps;
 
 	if (rule->mergeType == RBMergeType::RBMERGE_DICT) {
 		if (!IsDict()) {
@@ -164,14 +260,16 @@ void RBNodeList::Merge(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRul
 			//for (const auto& node : m_nodes) ss << node->GetName() << ", ";
 			throw std::runtime_error(ss.str());
 		}
-		if (!otherList->IsDict()) {
-			std::stringstream ss;
-			ss << "Update '" << m_name << "' is not a valid dict.";
-			throw std::runtime_error(ss.str());
+		for (const auto& otherList : otherLists) {
+			if (!otherList->IsDict()) {
+				std::stringstream ss;
+				ss << "Update '" << m_name << "' is not a valid dict.";
+				throw std::runtime_error(ss.str());
+			}
+			otherListMaps.push_back(otherList->AsDictMap());
 		}
 
 		listMap = AsDictMap();
-		otherListMap = otherList->AsDictMap();
 	}
 	else if (rule->mergeType == RBMergeType::RBMERGE_LIST) {
 		if (!IsList()) {
@@ -180,121 +278,176 @@ void RBNodeList::Merge(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRul
 			for (const auto& node : m_nodes) ss << node->GetName() << ", ";
 			throw std::runtime_error(ss.str());
 		}
-		if (!otherList->IsList()) {
-			std::stringstream ss;
-			ss << "Update '" << m_name << "' is not a valid list.";
-			throw std::runtime_error(ss.str());
-		}
 
-		std::string listName;
-		if (!Empty()) {
-			listName = ListName();
-			if (!otherList->Empty() && listName.compare(otherList->ListName()) != 0) {
+		// the list name is taken from the first update that adds elements to an empty base
+		std::string listName = ListName();
+		for (const auto& otherList : otherLists) {
+			if (!otherList->IsList()) {
 				std::stringstream ss;
-				ss << "List names of '" << m_name << "' do not match: " << listName << ", " << otherList->ListName() << ".";
+				ss << "Update '" << m_name << "' is not a valid list.";
 				throw std::runtime_error(ss.str());
 			}
-		}
-		else {
-			if (otherList->Empty()) {
-				return; // both empty
+
+			std::string otherListName = otherList->ListName();
+			if (listName.empty()) {
+				if (otherList->Empty()) {
+					otherListMaps.emplace_back(); // both empty
+					continue;
+				}
+			}
+			else if (!otherList->Empty() && listName.compare(otherListName) != 0) {
+				std::stringstream ss;
+				ss << "List names of '" << m_name << "' do not match: " << listName << ", " << otherListName << ".";
+				throw std::runtime_error(ss.str());
+			}
+
+			std::string elementName = listName.empty() ? otherListName : listName;
+			if (elementName.empty()) {
+				std::stringstream ss;
+				ss << "'" << m_name << "' is not a list.";
+				throw std::runtime_error(ss.str());
+			}
+			const std::shared_ptr<RBMergeRule>& listElementRule = rules->Get(elementName);
+			if (listElementRule->listKey.empty()) {
+				std::stringstream ss;
+				ss << "List element type '" << elementName << "' of list '" << m_name << "' has no list key set.";
+				throw std::runtime_error(ss.str());
+			}
+
+			otherListMaps.push_back(otherList->AsListMap(listElementRule->listKey));
+			if (listName.empty() && listElementRule->ruleNew == RBMergeRuleNew::RBMERGE_ADD) {
+				listName = elementName;
 			}
-			listName = otherList->ListName();
-		}
-		if (listName.empty()) {
-			std::stringstream ss;
-			ss << "'" << m_name << "' is not a list.";
-			throw std::runtime_error(ss.str());
-		}
-		std::shared_ptr<RBMergeRule> listElementRule = rules->Get(listName);
-		if (listElementRule->listKey.empty()) {
-			std::stringstream ss;
-			ss << "List element type '" << listName << "' of list '" << m_name << "' has no list key set.";
-			throw std::runtime_error(ss.str());
 		}
 
-		listMap = AsListMap(listElementRule->listKey);
-		otherListMap = otherList->AsListMap(listElementRule->listKey);
+		if (!Empty()) {
+			listMap = AsListMap(rules->Get(listName)->listKey);
+		}
 	}
 
-	for (const auto& otherEntry : otherListMap) {
-		auto otherNode = otherEntry.second.second;
-		//const RBNodeType otherType = otherNode->GetType();
+	// entries that exist in base, update/merge with every update in load order
+	std::vector<std::pair<size_t, std::vector<std::shared_ptr<RBNode>>>> entries;
+	for (const auto& baseEntry : listMap) {
+		std::vector<std::shared_ptr<RBNode>> updates;
+		for (const auto& otherListMap : otherListMaps) {
+			auto otherEntry = otherListMap.find(baseEntry.first);
+			if (otherEntry != otherListMap.end()) {
+				updates.push_back(otherEntry->second.second);
+			}
+		}
+		if (!updates.empty()) {
+			entries.emplace_back(baseEntry.second.first, std::move(updates));
+		}
+	}
 
-		auto baseEntry = listMap.find(otherEntry.first);
+	// entries that do not exist in base, added in the order the updates would have added them
+	std::set<std::string> newKeys;
+	for (size_t i = 0; i < otherListMaps.size(); ++i) {
+		for (const auto& otherEntry : otherListMaps[i]) {
+			if (listMap.count(otherEntry.first) > 0 || newKeys.count(otherEntry.first) > 0) {
+				continue;
+			}
+			auto otherNode = otherEntry.second.second;
+			const std::shared_ptr<RBMergeRule>& nodeRule = rules->Get(otherNode->GetName());
+			if (nodeRule->ruleNew != RBMergeRuleNew::RBMERGE_ADD) {
+				continue;
+			}
 
-		std::shared_ptr<RBMergeRule> nodeRule = rules->Get(otherNode->GetName());
+			newKeys.insert(otherEntry.first);
+			AddNode(otherNode);
 
-		if (baseEntry != listMap.end()) {
-			auto baseNode = baseEntry->second.second;
-			const RBNodeType baseType = baseNode->GetType();
-			// exists in base list, update/merge
-			switch (nodeRule->ruleShared)
-			{
-			case RBMergeRuleShared::RBMERGE_IGNORE:
-				break;
-			case RBMergeRuleShared::RBMERGE_REPLACE:
-				SetNode(otherNode, baseEntry->second.first);
-				break;
-			case RBMergeRuleShared::RBMERGE_MERGE:
-				if (baseType == RBNodeType::RBNODE_EMPTY) {
-					SetNode(otherNode, baseEntry->second.first);
-				}
-				else {
-					baseNode->Merge(otherNode, rules);
+			std::vector<std::shared_ptr<RBNode>> updates;
+			for (size_t k = i + 1; k < otherListMaps.size(); ++k) {
+				auto laterEntry = otherListMaps[k].find(otherEntry.first);
+				if (laterEntry != otherListMaps[k].end()) {
+					updates.push_back(laterEntry->second.second);
 				}
-				break;
-			default:
-				break;
 			}
-
-		}
-		else {
-			// does not exist in base , add
-			switch (nodeRule->ruleNew)
-			{
-			case RBMergeRuleNew::RBMERGE_IGNORE:
-				break;
-			case RBMergeRuleNew::RBMERGE_ADD:
-				AddNode(otherNode);
-				break;
-			default:
-				break;
+			if (!updates.empty()) {
+				entries.emplace_back(m_nodes.size() - 1, std::move(updates));
 			}
 		}
 	}
-	return;
-	// handle removed nodes
-	for (const auto& baseEntry : listMap) {
-		auto baseNode = baseEntry.second.second;
-		//const RBNodeType baseType = otherNode->GetType();
 
-		auto otherEntry = otherListMap.find(baseEntry.first);
+	// all structural changes are done, the entries are disjoint subtrees and only replace their own slot
+	parallelFor(entries.size(), [this, &entries, &rules](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			const size_t index = entries[i].first;
+			m_nodes[index] = MergeEntry(m_nodes[index], entries[i].second, rules);
+		}
+	});
+}
 
-		if (otherEntry == otherListMap.end()) {
-			std::shared_ptr<RBMergeRule> nodeRule = rules->Get(baseNode->GetName());
-			switch (nodeRule->ruleRemoved)
-			{
-			case RBMergeRuleRemoved::RBMERGE_IGNORE:
-				break;
-			case RBMergeRuleRemoved::RBMERGE_REMOVE:
-				RemoveNode(baseNode);
-				break;
-			default:
-				break;
+std::shared_ptr<RBNode> RBNodeList::MergeEntry(std::shared_ptr<RBNode> baseNode, const std::vector<std::shared_ptr<RBNode>>& updates, std::shared_ptr<RBMergeRules> rules)
+{
+	for (size_t i = 0; i < updates.size(); ++i) {
+		auto otherNode = updates[i];
+		const std::shared_ptr<RBMergeRule>& nodeRule = rules->Get(otherNode->GetName());
+		switch (nodeRule->ruleShared)
+		{
+		case RBMergeRuleShared::RBMERGE_IGNORE:
+			break;
+		case RBMergeRuleShared::RBMERGE_REPLACE:
+			baseNode = otherNode;
+			break;
+		case RBMergeRuleShared::RBMERGE_MERGE:
+			if (baseNode->GetType() == RBNodeType::RBNODE_EMPTY) {
+				baseNode = otherNode;
 			}
-
+			else {
+				// the base node keeps its type from here on, so the remaining updates can descend together
+				baseNode->MergeAll(std::vector<std::shared_ptr<RBNode>>(updates.begin() + i, updates.end()), rules);
+				return baseNode;
+			}
+			break;
+		default:
+			break;
 		}
 	}
+	return baseNode;
 }
 
-void RBNodeList::Serialize(std::ostream& out, int indent) const
+void RBNodeList::Serialize(RBWriteBuffer& out, int indent) const
 {
-	writeLnBracketOpenNamed(out, indent, m_name);
+	out.AppendIndent(indent);
+	out.Append(m_name);
+	out.Append('\n');
+	out.AppendIndent(indent);
+	out.Append("{\n", 2);
 	for (const auto& node : m_nodes) {
 		node->Serialize(out, indent + 1);
 	}
-	writeLnBracketClose(out, indent);
+	out.AppendIndent(indent);
+	out.Append("}\n\n", 3); // bracket closed has 2 newline afterwards
+}
+
+void RBNodeList::CollectMemoryStats(RBMemoryStats& stats) const
+{
+	++stats.nodes[static_cast<int>(RBNodeType::RBNODE_LIST)];
+	++stats.controlBlocks;
+	stats.nameBytes += m_name.size();
+	stats.heapBytes += sharedAllocationBytes(sizeof(RBNodeList)) + stringHeapBytes(m_name) + m_nodes.capacity() * sizeof(std::shared_ptr<RBNode>);
+	stats.heapBytes += stringHeapBytes(m_listKeyName) + m_listKeys.capacity() * sizeof(std::string);
+	for (const auto& key : m_listKeys) {
+		stats.heapBytes += stringHeapBytes(key);
+	}
+	for (const auto& node : m_nodes) {
+		node->CollectMemoryStats(stats);
+	}
+}
+
+RBSerializedSize RBNodeList::ComputeSerializedSize() const
+{
+	// name, opening and closing bracket lines
+	RBSerializedSize size;
+	size.bytes = m_name.size() + 1 + 2 + 3;
+	size.lines = 3;
+	for (const auto& node : m_nodes) {
+		const RBSerializedSize& nodeSize = node->GetSerializedSize();
+		size.bytes += nodeSize.AtIndent(1);
+		size.lines += nodeSize.lines;
+	}
+	return size;
 }
 
 bool RBNodeList::Compare(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules) const
@@ -303,7 +456,7 @@ bool RBNodeList::Compare(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeR
 		return false;
 	}
 
-	std::shared_ptr<RBMergeRule> rule = rules->Get(m_name);
+	const std::shared_ptr<RBMergeRule>& rule = rules->Get(m_name);
 	std::shared_ptr<RBNodeList> otherList = std::static_pointer_cast<RBNodeList>(other);
 
 	if (Size() != otherList->Size()) {
@@ -317,6 +470,9 @@ bool RBNodeList::Compare(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeR
 			ss << "Node '" << m_name << "' is not a valid dict.";
 			throw std::runtime_error(ss.str());
 		}
+		if (GetHash(rules) != otherList->GetHash(rules)) {
+			return false;
+		}
 		// here: same length and all nodes have different names
 		for (const auto& node : m_nodes) {
 			if (otherList->Contains(node->GetName())) {
@@ -337,6 +493,9 @@ bool RBNodeList::Compare(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeR
 			ss << "Node '" << m_name << "' is not a valid list.";
 			throw std::runtime_error(ss.str());
 		}
+		if (GetHash(rules) != otherList->GetHash(rules)) {
+			return false;
+		}
 		
 		std::string listName = ListName();
 		std::string otherListName = otherList->ListName();
@@ -347,7 +506,7 @@ bool RBNodeList::Compare(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeR
 			return true;
 		}
 
-		std::shared_ptr<RBMergeRule> listElementRule = rules->Get(listName);
+		const std::shared_ptr<RBMergeRule>& listElementRule = rules->Get(listName);
 		std::string listKeyName = listElementRule->listKey;
 		if (listKeyName.empty()) {
 			std::stringstream ss;
@@ -417,6 +576,45 @@ bool RBNodeList::Compare(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeR
 	}
 	return true;
 }
+uint64_t RBNodeList::ComputeHash(std::shared_ptr<RBMergeRules> rules) const
+{
+	uint64_t hash = combineHash(combineHash(static_cast<uint64_t>(RBNodeType::RBNODE_LIST), stringHash(m_name)), m_nodes.size());
+
+	// children are summed, so the hash does not depend on their order
+	uint64_t childrenHash = 0;
+	bool keyed = false;
+	const std::shared_ptr<RBMergeRule>& rule = rules->Get(m_name);
+	if (rule->mergeType == RBMergeType::RBMERGE_LIST && !Empty() && IsList()) {
+		// Compare() only looks at the first node of duplicate keys
+		std::string listKeyName = rules->Get(ListName())->listKey;
+		std::set<std::string> keys;
+		keyed = !listKeyName.empty();
+		for (size_t i = 0; keyed && i < m_nodes.size(); ++i) {
+			std::shared_ptr<RBNodeList> nodeList = std::static_pointer_cast<RBNodeList>(m_nodes[i]);
+			if (!nodeList->Contains(listKeyName)) {
+				keyed = false;
+				break;
+			}
+			std::shared_ptr<RBNode> keyNode = nodeList->GetNode(listKeyName);
+			if (keyNode->GetType() != RBNodeType::RBNODE_VALUE) {
+				keyed = false;
+				break;
+			}
+			if (keys.insert(std::static_pointer_cast<RBNodeValue>(keyNode)->GetValue()).second) {
+				childrenHash += mixHash(nodeList->GetHash(rules));
+			}
+		}
+	}
+	if (!keyed) {
+		// not a valid keyed list, Compare() throws for these, so any stable value works
+		childrenHash = 0;
+		for (const auto& node : m_nodes) {
+			childrenHash += mixHash(node->GetHash(rules));
+		}
+	}
+	return combineHash(hash, childrenHash);
+}
+
 /*
 void RBNodeList::SetModified(const bool modified)
 {
@@ -426,13 +624,14 @@ void RBNodeList::SetModified(const bool modified)
 	}
 }*/
 
-void RBNodeList::RemoveEqual(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules)
+void RBNodeList::RemoveEqual(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules, std::map<std::string, size_t>& removedCounts)
 {
 	if (other->GetType() != RBNodeType::RBNODE_LIST || m_name.compare(other->GetName()) != 0) {
 		throw std::runtime_error("Can't remove equal if base node is different.");
 	}
+	InvalidateCache();
 
-	std::shared_ptr<RBMergeRule> rule = rules->Get(m_name);
+	const std::shared_ptr<RBMergeRule>& rule = rules->Get(m_name);
 	auto otherList = std::static_pointer_cast<RBNodeList>(other);
 
 	std::map<std::string, std::pair<size_t, std::shared_ptr<RBNode>>> listMap;
@@ -486,7 +685,7 @@ void RBNodeList::RemoveEqual(std::shared_ptr<RBNode> other, std::shared_ptr<RBMe
 			ss << "'" << m_name << "' is not a list.";
 			throw std::runtime_error(ss.str());
 		}
-		std::shared_ptr<RBMergeRule> listElementRule = rules->Get(listName);
+		const std::shared_ptr<RBMergeRule>& listElementRule = rules->Get(listName);
 		if (listElementRule->listKey.empty()) {
 			std::stringstream ss;
 			ss << "List element type '" << listName << "' of list '" << m_name << "' has no list key set.";
@@ -497,23 +696,48 @@ void RBNodeList::RemoveEqual(std::shared_ptr<RBNode> other, std::shared_ptr<RBMe
 		otherListMap = otherList->AsListMap(listElementRule->listKey);
 	}
 
+	std::vector<std::pair<std::pair<size_t, std::shared_ptr<RBNode>>, std::shared_ptr<RBNode>>> entries;
 	for (const auto& baseEntry : listMap) {
-		auto baseNode = baseEntry.second.second;
-		//const RBNodeType baseType = otherNode->GetType();
-
 		auto otherEntry = otherListMap.find(baseEntry.first);
-
 		if (otherEntry != otherListMap.end()) {
-			std::shared_ptr<RBMergeRule> nodeRule = rules->Get(baseNode->GetName());
-			auto otherNode = otherEntry->second.second;
+			entries.emplace_back(baseEntry.second, otherEntry->second.second);
+		}
+	}
+
+	// equal nodes are only marked here and removed in one pass afterwards.
+	// the entries are disjoint subtrees, so they can be diffed in parallel.
+	std::vector<char> removed(m_nodes.size(), 0);
+	std::mutex countsMutex;
+	parallelFor(entries.size(), [&](size_t begin, size_t end) {
+		std::map<std::string, size_t> chunkCounts;
+		for (size_t i = begin; i < end; ++i) {
+			auto baseNode = entries[i].first.second;
+			auto otherNode = entries[i].second;
+			//const RBNodeType baseType = otherNode->GetType();
 			if (baseNode->GetName().compare(rule->listKey)!=0 && baseNode->Compare(otherNode, rules)) {
 				// do not remove entires that are used as list key.
-				RemoveNode(baseNode);
+				removed[entries[i].first.first] = true;
 			}
 			else if(baseNode->GetName().compare(otherNode->GetName())==0 && baseNode->GetType()==RBNodeType::RBNODE_LIST && otherNode->GetType()==RBNodeType::RBNODE_LIST){
-				baseNode->RemoveEqual(otherNode, rules);
+				baseNode->RemoveEqual(otherNode, rules, chunkCounts);
 			}
 		}
+		std::lock_guard<std::mutex> lock(countsMutex);
+		for (const auto& [listName, count] : chunkCounts) {
+			removedCounts[listName] += count;
+		}
+	});
+
+	const size_t numRemoved = std::count(removed.begin(), removed.end(), 1);
+	if (numRemoved > 0) {
+		size_t next = 0;
+		for (size_t i = 0; i < m_nodes.size(); ++i) {
+			if (!removed[i]) {
+				m_nodes[next++] = std::move(m_nodes[i]);
+			}
+		}
+		m_nodes.resize(next);
+		removedCounts[m_name] += numRemoved;
 	}
 }
 
@@ -537,11 +761,45 @@ void RBNodeValue::Merge(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRu
 	auto otherValue = std::static_pointer_cast<RBNodeValue>(other);
 
 	m_value = otherValue->m_value;
+	InvalidateCache();
 }
 
-void RBNodeValue::Serialize(std::ostream& out, int indent) const
+void RBNodeValue::MergeAll(const std::vector<std::shared_ptr<RBNode>>& others, std::shared_ptr<RBMergeRules> rules)
 {
-	writeLnPairIndented(out, indent, m_name, m_value);
+	for (const auto& other : others) {
+		Merge(other, rules);
+	}
+}
+
+void RBNodeValue::Serialize(RBWriteBuffer& out, int indent) const
+{
+	out.AppendIndent(indent);
+	out.Append(m_name);
+	out.Append(' ');
+	out.Append(m_value);
+	out.Append('\n');
+}
+
+void RBNodeValue::CollectMemoryStats(RBMemoryStats& stats) const
+{
+	++stats.nodes[static_cast<int>(RBNodeType::RBNODE_VALUE)];
+	++stats.controlBlocks;
+	stats.nameBytes += m_name.size();
+	stats.valueBytes += m_value.size();
+	stats.heapBytes += sharedAllocationBytes(sizeof(RBNodeValue)) + stringHeapBytes(m_name) + stringHeapBytes(m_value);
+}
+
+RBSerializedSize RBNodeValue::ComputeSerializedSize() const
+{
+	RBSerializedSize size;
+	size.bytes = m_name.size() + 1 + m_value.size() + 1;
+	size.lines = 1;
+	return size;
+}
+
+uint64_t RBNodeValue::ComputeHash(std::shared_ptr<RBMergeRules> rules) const
+{
+	return combineHash(combineHash(static_cast<uint64_t>(RBNodeType::RBNODE_VALUE), stringHash(m_name)), stringHash(m_value));
 }
 
 bool RBNodeValue::Compare(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules) const
@@ -572,9 +830,39 @@ void RBNodeEmpty::Merge(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRu
 	}
 }
 
-void RBNodeEmpty::Serialize(std::ostream& out, int indent) const
+void RBNodeEmpty::MergeAll(const std::vector<std::shared_ptr<RBNode>>& others, std::shared_ptr<RBMergeRules> rules)
+{
+	for (const auto& other : others) {
+		Merge(other, rules);
+	}
+}
+
+void RBNodeEmpty::Serialize(RBWriteBuffer& out, int indent) const
+{
+	out.AppendIndent(indent);
+	out.Append(m_name);
+	out.Append('\n');
+}
+
+void RBNodeEmpty::CollectMemoryStats(RBMemoryStats& stats) const
+{
+	++stats.nodes[static_cast<int>(RBNodeType::RBNODE_EMPTY)];
+	++stats.controlBlocks;
+	stats.nameBytes += m_name.size();
+	stats.heapBytes += sharedAllocationBytes(sizeof(RBNodeEmpty)) + stringHeapBytes(m_name);
+}
+
+RBSerializedSize RBNodeEmpty::ComputeSerializedSize() const
+{
+	RBSerializedSize size;
+	size.bytes = m_name.size() + 1;
+	size.lines = 1;
+	return size;
+}
+
+uint64_t RBNodeEmpty::ComputeHash(std::shared_ptr<RBMergeRules> rules) const
 {
-	writeLnIndented(out, indent, m_name);
+	return combineHash(static_cast<uint64_t>(RBNodeType::RBNODE_EMPTY), stringHash(m_name));
 }
 
 bool RBNodeEmpty::Compare(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules) const
@@ -586,7 +874,7 @@ bool RBNodeEmpty::Compare(std::shared_ptr<RBNode> other, std::shared_ptr<RBMerge
 	return true;
 }
 
-const std::shared_ptr<RBMergeRule> RBMergeRules::Get(const std::string& name) const
+const std::shared_ptr<RBMergeRule>& RBMergeRules::Get(const std::string& name) const
 {
 	auto rule = m_rules.find(name);
 	if (rule != m_rules.end()) {
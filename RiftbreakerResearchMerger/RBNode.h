@@ -1,10 +1,12 @@
 #pragma once
 #include <stdexcept>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <map>
 #include <memory>
 #include "RBMergeRules.h"
+#include "RBWriteBuffer.h"
 
 enum class RBNodeType {
 	RBNODE_EMPTY = 0,
@@ -16,6 +18,28 @@ class RBNodeValue;
 class RBNodeList;
 class RBNodeEmpty;
 
+// Serialized length of a subtree at indent 0 and the number of indented lines,
+// each of which gets one more tab per indent level.
+struct RBSerializedSize
+{
+	size_t bytes = 0;
+	size_t lines = 0;
+	size_t AtIndent(int indent) const { return bytes + lines * indent; }
+};
+
+// Memory held by a subtree. Every node is one make_shared allocation with its own control block.
+struct RBMemoryStats
+{
+	size_t nodes[3] = { 0, 0, 0 }; // by RBNodeType
+	size_t nameBytes = 0;
+	size_t valueBytes = 0;
+	size_t controlBlocks = 0;
+	// nodes, control blocks, child vectors and string buffers on the heap
+	size_t heapBytes = 0;
+	void Add(const RBMemoryStats& other);
+	size_t NumNodes() const { return nodes[0] + nodes[1] + nodes[2]; }
+};
+
 class RBNode
 {
 public:
@@ -23,11 +47,33 @@ public:
 	virtual RBNodeType GetType() const = 0;
 	virtual std::string GetName() const = 0;
 	virtual void Merge(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules) = 0;
-	virtual void Serialize(std::ostream &out, int indent) const = 0;
+	// merge all others in load order in a single traversal, same result as calling Merge() for each
+	virtual void MergeAll(const std::vector<std::shared_ptr<RBNode>>& others, std::shared_ptr<RBMergeRules> rules) = 0;
+	virtual void Serialize(RBWriteBuffer& out, int indent) const = 0;
 	virtual bool Compare(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules) const = 0;
 	//virtual void SetModified(const bool modified) = 0;
 	//virtual bool IsModified() const = 0;
-	virtual void RemoveEqual(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules) = 0;
+	// removes all nodes that are equal in other, removedCounts gets the number of removed nodes per list name
+	virtual void RemoveEqual(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules, std::map<std::string, size_t>& removedCounts) = 0;
+	// structural hash of the subtree, nodes that Compare() equal have the same hash. Cached until the node is modified.
+	uint64_t GetHash(std::shared_ptr<RBMergeRules> rules) const;
+	// exact length of the Serialize() output, cached until the node is modified
+	const RBSerializedSize& GetSerializedSize() const;
+	virtual void CollectMemoryStats(RBMemoryStats& stats) const = 0;
+protected:
+	virtual uint64_t ComputeHash(std::shared_ptr<RBMergeRules> rules) const = 0;
+	virtual RBSerializedSize ComputeSerializedSize() const = 0;
+	// only clears this node: subtrees are shared between trees, so a node has no single parent to clear
+	virtual void InvalidateCache() { m_hashRules = nullptr; m_sizeValid = false; }
+private:
+	// Hash and size are filled on first use without locking. Trees are only modified through Merge, MergeAll and
+	// RemoveEqual called on an ancestor, which clear every node on their way down; a node changed on its own leaves
+	// the caches of its ancestors stale. A tree is hashed by one thread before it is compared concurrently
+	// (see RBFile::UpdateHashes) and must not be hashed by several threads at once.
+	mutable uint64_t m_hash = 0;
+	mutable const RBMergeRules* m_hashRules = nullptr;
+	mutable RBSerializedSize m_size;
+	mutable bool m_sizeValid = false;
 };
 
 class RBNodeValue : public RBNode
@@ -39,11 +85,16 @@ public:
 	std::string GetName() const override { return m_name; }
 	std::string GetValue() const { return m_value; }
 	void Merge(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules) override;
-	void Serialize(std::ostream& out, int indent) const override;
+	void MergeAll(const std::vector<std::shared_ptr<RBNode>>& others, std::shared_ptr<RBMergeRules> rules) override;
+	void Serialize(RBWriteBuffer& out, int indent) const override;
 	bool Compare(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules) const override;
+	void CollectMemoryStats(RBMemoryStats& stats) const override;
 	//void SetModified(const bool modified) override { m_modified = modified; };
 	//bool IsModified() const override { return m_modified; }
-	void RemoveEqual(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules) override { throw std::runtime_error("Can't remove from value node"); }
+	void RemoveEqual(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules, std::map<std::string, size_t>& removedCounts) override { throw std::runtime_error("Can't remove from value node"); }
+protected:
+	uint64_t ComputeHash(std::shared_ptr<RBMergeRules> rules) const override;
+	RBSerializedSize ComputeSerializedSize() const override;
 private:
 	std::string m_name;
 	std::string m_value;
@@ -59,8 +110,8 @@ public:
 	RBNodeType GetType() const override { return RBNodeType::RBNODE_LIST; }
 	std::string GetName() const override { return m_name; }
 	std::vector<std::shared_ptr<RBNode>> GetNodes() { return m_nodes; }
-	void AddNode(std::shared_ptr<RBNode> node) { m_nodes.push_back(node); }
-	void SetNode(std::shared_ptr<RBNode> node, size_t index) { m_nodes[index] = node; }
+	void AddNode(std::shared_ptr<RBNode> node) { m_nodes.push_back(node); InvalidateCache(); }
+	void SetNode(std::shared_ptr<RBNode> node, size_t index) { m_nodes[index] = node; InvalidateCache(); }
 	void RemoveNode(std::shared_ptr<RBNode> node);
 	size_t Size() const { return m_nodes.size(); }
 	bool Empty() const { return m_nodes.size()==0; }
@@ -68,21 +119,34 @@ public:
 	bool Contains(std::string name) const;
 	std::shared_ptr<RBNode> GetNode(std::string name);
 	void Merge(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules) override;
+	void MergeAll(const std::vector<std::shared_ptr<RBNode>>& others, std::shared_ptr<RBMergeRules> rules) override;
 	bool IsDict() const;
 	std::map<std::string, std::pair<size_t, std::shared_ptr<RBNode>>> AsDictMap();
 	bool IsList() const;
 	std::string ListName() const;
 	std::map<std::string, std::pair<size_t, std::shared_ptr<RBNode>>> AsListMap(std::string &keyName);
-	void Serialize(std::ostream& out, int indent) const override;
+	// value of the key node of every list entry
+	std::vector<std::string> ListKeys(const std::string& keyName) const;
+	// keys known in advance, used by AsListMap until the list is modified
+	void SetListKeys(const std::string& keyName, std::vector<std::string> keys) { m_listKeyName = keyName; m_listKeys = std::move(keys); }
+	void Serialize(RBWriteBuffer& out, int indent) const override;
 	bool Compare(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules) const override;
+	void CollectMemoryStats(RBMemoryStats& stats) const override;
 	//void SetModified(const bool modified) override;
 	//bool IsModified() const override { return m_modified; }
-	void RemoveEqual(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules) override;
+	void RemoveEqual(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules, std::map<std::string, size_t>& removedCounts) override;
+protected:
+	uint64_t ComputeHash(std::shared_ptr<RBMergeRules> rules) const override;
+	RBSerializedSize ComputeSerializedSize() const override;
+	void InvalidateCache() override { RBNode::InvalidateCache(); m_listKeys.clear(); }
 private:
+	static std::shared_ptr<RBNode> MergeEntry(std::shared_ptr<RBNode> baseNode, const std::vector<std::shared_ptr<RBNode>>& updates, std::shared_ptr<RBMergeRules> rules);
 
 	std::string m_name;
 	std::vector<std::shared_ptr<RBNode>> m_nodes;
 	bool m_modified;
+	std::string m_listKeyName;
+	std::vector<std::string> m_listKeys;
 };
 
 class RBNodeEmpty : public RBNode
@@ -93,11 +157,16 @@ public:
 	std::string GetName() const override { return m_name; }
 	std::shared_ptr<RBNode> Copy() const override;
 	void Merge(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules) override;
-	void Serialize(std::ostream& out, int indent) const override;
+	void MergeAll(const std::vector<std::shared_ptr<RBNode>>& others, std::shared_ptr<RBMergeRules> rules) override;
+	void Serialize(RBWriteBuffer& out, int indent) const override;
 	bool Compare(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules) const override;
+	void CollectMemoryStats(RBMemoryStats& stats) const override;
 	//void SetModified(const bool modified) override { m_modified = modified; };
 	//bool IsModified() const override { return m_modified; }
-	void RemoveEqual(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules) override { throw std::runtime_error("Can't remove from value node"); }
+	void RemoveEqual(std::shared_ptr<RBNode> other, std::shared_ptr<RBMergeRules> rules, std::map<std::string, size_t>& removedCounts) override { throw std::runtime_error("Can't remove from value node"); }
+protected:
+	uint64_t ComputeHash(std::shared_ptr<RBMergeRules> rules) const override;
+	RBSerializedSize ComputeSerializedSize() const override;
 private:
 	std::string m_name;
 	bool m_modified;
@@ -0,0 +1,211 @@
+#include "RBPackIndex.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "RBPackReader.h"
+
+static const char packIndexMagic[4] = { 'R', 'B', 'P', 'I' };
+// bump when the format changes, older index files are then read from the packs again
+static const uint64_t packIndexVersion = 1;
+static const char* packIndexExt = ".index";
+
+std::filesystem::path uniqueTempPath(const std::filesystem::path& path)
+{
+	static std::atomic<size_t> tempCounter(0);
+#ifdef _WIN32
+	unsigned long processId = GetCurrentProcessId();
+#else
+	long processId = getpid();
+#endif
+	std::stringstream tempName;
+	tempName << path.string() << '.' << processId << '.' << std::this_thread::get_id() << '.' << tempCounter++ << ".temp";
+	return tempName.str();
+}
+
+static std::string lowerCase(std::string name)
+{
+	std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	return name;
+}
+
+static void writeVarint(std::string& out, uint64_t value)
+{
+	while (value >= 0x80) {
+		out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<char>(value));
+}
+
+static void writeString(std::string& out, const std::string& value)
+{
+	writeVarint(out, value.size());
+	out.append(value);
+}
+
+// reads the index file, any read past its end fails
+class PackIndexReader
+{
+public:
+	PackIndexReader(const std::string& data, size_t pos) : m_data(data), m_pos(pos) {}
+	bool ReadVarint(uint64_t& value) {
+		value = 0;
+		for (int shift = 0; shift < 64 && m_pos < m_data.size(); shift += 7) {
+			uint8_t byte = static_cast<uint8_t>(m_data[m_pos++]);
+			value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+	bool ReadString(std::string& value) {
+		uint64_t length;
+		if (!ReadVarint(length) || length > m_data.size() - m_pos) {
+			return false;
+		}
+		value.assign(m_data, m_pos, length);
+		m_pos += length;
+		return true;
+	}
+	bool AtEnd() const { return m_pos == m_data.size(); }
+private:
+	const std::string& m_data;
+	size_t m_pos;
+};
+
+std::shared_ptr<RBPackIndex> RBPackIndex::Build(RBPackReader& pack, const std::string& stamp)
+{
+	mz_zip_archive* zip = pack.Zip();
+	if (!zip) {
+		return nullptr;
+	}
+	auto index = std::make_shared<RBPackIndex>();
+	index->m_stamp = stamp;
+	mz_uint numFiles = mz_zip_reader_get_num_files(zip);
+	index->m_entries.reserve(numFiles);
+	for (mz_uint i = 0; i < numFiles; ++i) {
+		mz_zip_archive_file_stat stat;
+		if (!mz_zip_reader_file_stat(zip, i, &stat)) {
+			return nullptr;
+		}
+		Entry entry;
+		entry.name = stat.m_filename;
+		entry.localHeaderOffset = stat.m_local_header_ofs;
+		entry.compSize = stat.m_comp_size;
+		entry.uncompSize = stat.m_uncomp_size;
+		entry.crc = stat.m_crc32;
+		entry.method = stat.m_method;
+		entry.bitFlag = stat.m_bit_flag;
+		entry.isDirectory = stat.m_is_directory;
+		index->AddEntry(std::move(entry));
+	}
+	return index;
+}
+
+std::shared_ptr<RBPackIndex> RBPackIndex::Load(const std::filesystem::path& indexPath, const std::string& stamp)
+{
+	std::ifstream instream(indexPath, std::ios::binary);
+	if (!instream) {
+		return nullptr;
+	}
+	std::string data((std::istreambuf_iterator<char>(instream)), std::istreambuf_iterator<char>());
+	if (data.size() < sizeof(packIndexMagic) || data.compare(0, sizeof(packIndexMagic), packIndexMagic, sizeof(packIndexMagic)) != 0) {
+		return nullptr;
+	}
+	PackIndexReader reader(data, sizeof(packIndexMagic));
+	uint64_t version;
+	std::string fileStamp;
+	uint64_t count;
+	if (!reader.ReadVarint(version) || version != packIndexVersion || !reader.ReadString(fileStamp) || fileStamp != stamp || !reader.ReadVarint(count)) {
+		return nullptr;
+	}
+	// every entry takes at least 8 bytes
+	if (count > data.size() / 8) {
+		return nullptr;
+	}
+	auto index = std::make_shared<RBPackIndex>();
+	index->m_stamp = stamp;
+	index->m_entries.reserve(count);
+	for (uint64_t i = 0; i < count; ++i) {
+		Entry entry;
+		uint64_t crc, method, bitFlag, isDirectory;
+		if (!reader.ReadString(entry.name) || !reader.ReadVarint(entry.localHeaderOffset) || !reader.ReadVarint(entry.compSize) || !reader.ReadVarint(entry.uncompSize)
+			|| !reader.ReadVarint(crc) || !reader.ReadVarint(method) || !reader.ReadVarint(bitFlag) || !reader.ReadVarint(isDirectory)) {
+			return nullptr;
+		}
+		entry.crc = static_cast<uint32_t>(crc);
+		entry.method = static_cast<uint16_t>(method);
+		entry.bitFlag = static_cast<uint16_t>(bitFlag);
+		entry.isDirectory = isDirectory != 0;
+		index->AddEntry(std::move(entry));
+	}
+	return reader.AtEnd() ? index : nullptr;
+}
+
+void RBPackIndex::Save(const std::filesystem::path& indexPath) const
+{
+	std::string data(packIndexMagic, sizeof(packIndexMagic));
+	writeVarint(data, packIndexVersion);
+	writeString(data, m_stamp);
+	writeVarint(data, m_entries.size());
+	for (const Entry& entry : m_entries) {
+		writeString(data, entry.name);
+		writeVarint(data, entry.localHeaderOffset);
+		writeVarint(data, entry.compSize);
+		writeVarint(data, entry.uncompSize);
+		writeVarint(data, entry.crc);
+		writeVarint(data, entry.method);
+		writeVarint(data, entry.bitFlag);
+		writeVarint(data, entry.isDirectory ? 1 : 0);
+	}
+
+	std::filesystem::create_directories(indexPath.parent_path());
+	// written to a temporary file of its own first like the cached patches, runs reading the index never see
+	// a partial one and runs rebuilding the same index do not write into each other's file, the last rename wins
+	std::filesystem::path tempPath = uniqueTempPath(indexPath);
+	try {
+		{
+			std::ofstream outstream(tempPath, std::ios::binary | std::ios::trunc);
+			outstream.write(data.data(), data.size());
+			if (!outstream) {
+				throw std::runtime_error("Failed to write file.");
+			}
+		}
+		std::filesystem::rename(tempPath, indexPath);
+	}
+	catch (...) {
+		std::error_code error;
+		std::filesystem::remove(tempPath, error);
+		throw;
+	}
+}
+
+std::filesystem::path RBPackIndex::GetIndexPath(const std::filesystem::path& cachePath, const std::filesystem::path& packPath)
+{
+	return std::filesystem::path(cachePath).append(packPath.filename().string() + packIndexExt);
+}
+
+const RBPackIndex::Entry* RBPackIndex::Find(const std::string& name) const
+{
+	auto it = m_entryIndexes.find(lowerCase(name));
+	return it != m_entryIndexes.end() ? &m_entries[it->second] : nullptr;
+}
+
+void RBPackIndex::AddEntry(Entry&& entry)
+{
+	m_entryIndexes.emplace(lowerCase(entry.name), m_entries.size());
+	m_entries.push_back(std::move(entry));
+}
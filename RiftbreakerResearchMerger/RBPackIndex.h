@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class RBPackReader;
+
+// Temporary file next to path for writing a cache file that is then renamed to path. Unique per process,
+// thread and call, so sessions sharing a cache folder never write into the same temporary file.
+std::filesystem::path uniqueTempPath(const std::filesystem::path& path);
+
+// Entries of a pack with where to find them, read once from the central directory of the pack
+// and kept in the patch cache folder. Packs are only read again when their size or write time changed,
+// entries are then read straight from their local header without setting up a zip reader.
+class RBPackIndex
+{
+public:
+	struct Entry {
+		std::string name;
+		uint64_t localHeaderOffset = 0;
+		uint64_t compSize = 0;
+		uint64_t uncompSize = 0;
+		uint32_t crc = 0;
+		uint16_t method = 0;
+		uint16_t bitFlag = 0;
+		bool isDirectory = false;
+	};
+
+	// reads the central directory of the pack, nullptr if the pack can not be read
+	static std::shared_ptr<RBPackIndex> Build(RBPackReader& pack, const std::string& stamp);
+	// nullptr if there is no index file or it was written for another stamp of the pack
+	static std::shared_ptr<RBPackIndex> Load(const std::filesystem::path& indexPath, const std::string& stamp);
+	// throws if the file can not be written
+	void Save(const std::filesystem::path& indexPath) const;
+	static std::filesystem::path GetIndexPath(const std::filesystem::path& cachePath, const std::filesystem::path& packPath);
+
+	const std::vector<Entry>& GetEntries() const { return m_entries; }
+	// ignores the case like miniz, nullptr if the pack has no such entry
+	const Entry* Find(const std::string& name) const;
+private:
+	void AddEntry(Entry&& entry);
+
+	std::string m_stamp;
+	std::vector<Entry> m_entries;
+	// by lower case name, the first entry of a name wins
+	std::unordered_map<std::string, size_t> m_entryIndexes;
+};
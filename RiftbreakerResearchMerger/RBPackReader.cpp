@@ -0,0 +1,527 @@
+#include "RBPackReader.h"
+#include <algorithm>
+#include <cstring>
+#include "RBCrc32.h"
+#include "RBInflate.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define RB_HAS_IO_URING
+#endif
+#endif
+
+RBPackReader::Mode RBPackReader::s_mode = RBPackReader::Mode::STDIO;
+
+// end of the pack read in the first batch, the end of central directory record with the longest
+// comment and in most packs the whole central directory
+static const size_t tailSize = 64 * 1024 + 22;
+// room for the extra field of a local header, which can differ from the central one
+static const size_t localExtraSize = 1024;
+static const mz_uint32 endOfCentralDirSig = 0x06054b50;
+static const size_t endOfCentralDirSize = 22;
+static const mz_uint32 localHeaderSig = 0x04034b50;
+static const size_t localHeaderSize = 30;
+// a single read returns at most this much on Linux, larger ranges are left to ReadAt
+static const size_t maxBatchedRead = 0x7FFFF000;
+
+#ifdef RB_HAS_IO_URING
+// Submission and completion rings of io_uring, set up with the raw system calls.
+class Uring
+{
+public:
+	Uring(unsigned entries) {
+		memset(&m_params, 0, sizeof(m_params));
+		m_fd = (int)syscall(__NR_io_uring_setup, entries, &m_params);
+		if (m_fd < 0) {
+			return;
+		}
+		m_sqSize = m_params.sq_off.array + m_params.sq_entries * sizeof(unsigned);
+		m_cqSize = m_params.cq_off.cqes + m_params.cq_entries * sizeof(io_uring_cqe);
+		bool single = m_params.features & IORING_FEAT_SINGLE_MMAP;
+		if (single) {
+			m_sqSize = m_cqSize = std::max(m_sqSize, m_cqSize);
+		}
+		m_sq = mmap(nullptr, m_sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+		m_cq = single ? m_sq : mmap(nullptr, m_cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+		m_sqesSize = m_params.sq_entries * sizeof(io_uring_sqe);
+		m_sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+		if (m_sq == MAP_FAILED || m_cq == MAP_FAILED || m_sqes == MAP_FAILED) {
+			Close();
+		}
+	}
+	~Uring() {
+		Close();
+	}
+	bool Valid() const { return m_fd >= 0; }
+	unsigned Entries() const { return m_params.sq_entries; }
+
+	// queues a read, there must be a free entry
+	void Read(int fd, void* buffer, unsigned size, uint64_t offset, uint64_t userData) {
+		char* sq = static_cast<char*>(m_sq);
+		unsigned tail = *reinterpret_cast<unsigned*>(sq + m_params.sq_off.tail);
+		unsigned index = tail & *reinterpret_cast<unsigned*>(sq + m_params.sq_off.ring_mask);
+		io_uring_sqe* sqe = static_cast<io_uring_sqe*>(m_sqes) + index;
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = fd;
+		sqe->addr = reinterpret_cast<uint64_t>(buffer);
+		sqe->len = size;
+		sqe->off = offset;
+		sqe->user_data = userData;
+		reinterpret_cast<unsigned*>(sq + m_params.sq_off.array)[index] = index;
+		__atomic_store_n(reinterpret_cast<unsigned*>(sq + m_params.sq_off.tail), tail + 1, __ATOMIC_RELEASE);
+		++m_queued;
+	}
+	// submits the queued reads and waits for all of them, done(userData, result) for each.
+	// If the ring fails it is closed and false returned, reads not passed to done may still be in flight
+	// and write into their buffers.
+	template <typename F>
+	bool Complete(F done) {
+		unsigned submit = m_queued;
+		unsigned pending = m_queued;
+		m_queued = 0;
+		char* cq = static_cast<char*>(m_cq);
+		unsigned* head = reinterpret_cast<unsigned*>(cq + m_params.cq_off.head);
+		unsigned* tail = reinterpret_cast<unsigned*>(cq + m_params.cq_off.tail);
+		unsigned mask = *reinterpret_cast<unsigned*>(cq + m_params.cq_off.ring_mask);
+		io_uring_cqe* cqes = reinterpret_cast<io_uring_cqe*>(cq + m_params.cq_off.cqes);
+		while (pending > 0) {
+			int result = (int)syscall(__NR_io_uring_enter, m_fd, submit, pending, IORING_ENTER_GETEVENTS, nullptr, 0);
+			if (result < 0 && errno != EINTR) {
+				// completions left in the ring would be taken for reads of the next batch
+				Close();
+				return false;
+			}
+			if (result > 0) {
+				submit -= std::min<unsigned>(submit, result);
+			}
+			unsigned current = *head;
+			unsigned end = __atomic_load_n(tail, __ATOMIC_ACQUIRE);
+			for (; current != end; ++current) {
+				const io_uring_cqe& cqe = cqes[current & mask];
+				done(cqe.user_data, cqe.res);
+				--pending;
+			}
+			__atomic_store_n(head, current, __ATOMIC_RELEASE);
+		}
+		return true;
+	}
+private:
+	void Close() {
+		if (m_sqes && m_sqes != MAP_FAILED) munmap(m_sqes, m_sqesSize);
+		if (m_cq && m_cq != MAP_FAILED && m_cq != m_sq) munmap(m_cq, m_cqSize);
+		if (m_sq && m_sq != MAP_FAILED) munmap(m_sq, m_sqSize);
+		m_sq = m_cq = m_sqes = nullptr;
+		if (m_fd >= 0) close(m_fd);
+		m_fd = -1;
+	}
+
+	int m_fd = -1;
+	io_uring_params m_params;
+	void* m_sq = nullptr;
+	void* m_cq = nullptr;
+	void* m_sqes = nullptr;
+	size_t m_sqSize = 0;
+	size_t m_cqSize = 0;
+	size_t m_sqesSize = 0;
+	unsigned m_queued = 0;
+};
+#endif
+
+bool RBPackReader::SetMode(Mode mode)
+{
+	if (mode == Mode::URING) {
+#ifdef RB_HAS_IO_URING
+		if (!Uring(1).Valid()) {
+			return false;
+		}
+#else
+		return false;
+#endif
+	}
+	s_mode = mode;
+	return true;
+}
+
+bool RBPackReader::ParseMode(const std::string& name, Mode& mode)
+{
+	if (name == "stdio") {
+		mode = Mode::STDIO;
+	}
+	else if (name == "mmap") {
+		mode = Mode::MMAP;
+	}
+	else if (name == "uring") {
+		mode = Mode::URING;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+RBPackReader::RBPackReader(const std::filesystem::path& path, std::shared_ptr<const RBPackIndex> index)
+	: m_path(path), m_index(std::move(index))
+{
+	memset(&m_zip, 0, sizeof(m_zip));
+}
+
+RBPackReader::~RBPackReader()
+{
+	if (m_zipValid) {
+		mz_zip_reader_end(&m_zip);
+	}
+#ifdef _WIN32
+	if (m_mapping) UnmapViewOfFile(m_mapping);
+	if (m_mappingHandle) CloseHandle(m_mappingHandle);
+	if (m_file && m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+#else
+	if (m_mapping) munmap(m_mapping, m_size);
+	if (m_fd >= 0) close(m_fd);
+#endif
+}
+
+bool RBPackReader::Open()
+{
+	if (m_opened) {
+		return m_valid;
+	}
+	m_opened = true;
+#ifdef _WIN32
+	m_file = CreateFileW(m_path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER size;
+	if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size) || size.QuadPart == 0) {
+		return false;
+	}
+	m_size = size.QuadPart;
+	if (s_mode == Mode::STDIO) {
+		m_valid = true;
+		return true;
+	}
+	m_mappingHandle = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	m_mapping = m_mappingHandle ? MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	m_valid = m_mapping != nullptr;
+#else
+	m_fd = open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat fileStat;
+	if (m_fd < 0 || fstat(m_fd, &fileStat) != 0 || fileStat.st_size == 0) {
+		return false;
+	}
+	m_size = fileStat.st_size;
+	if (s_mode == Mode::MMAP) {
+		m_mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+		if (m_mapping == MAP_FAILED) {
+			m_mapping = nullptr;
+			return false;
+		}
+	}
+	m_valid = true;
+#endif
+	return m_valid;
+}
+
+bool RBPackReader::IsReadable()
+{
+	if (m_index) {
+		if (!Open()) {
+			m_zip.m_last_error = MZ_ZIP_FILE_OPEN_FAILED;
+			return false;
+		}
+		return true;
+	}
+	return Zip() != nullptr;
+}
+
+mz_zip_archive* RBPackReader::Zip()
+{
+	if (!m_zipInit) {
+		m_zipInit = true;
+		m_zipValid = InitZip();
+	}
+	return m_zipValid ? &m_zip : nullptr;
+}
+
+bool RBPackReader::InitZip()
+{
+	if (s_mode == Mode::STDIO) {
+		// miniz opens the file itself
+		return mz_zip_reader_init_file(&m_zip, m_path.string().c_str(), 0);
+	}
+	if (!Open()) {
+		m_zip.m_last_error = MZ_ZIP_FILE_OPEN_FAILED;
+		return false;
+	}
+	if (m_mapping) {
+		return mz_zip_reader_init_mem(&m_zip, m_mapping, m_size, 0);
+	}
+	if (!m_directoryRead) {
+		ReadDirectories({ this });
+	}
+	m_zip.m_pRead = Read;
+	m_zip.m_pIO_opaque = this;
+	bool valid = mz_zip_reader_init(&m_zip, m_size, 0);
+	ReleaseRanges(UINT64_MAX, true);
+	return valid;
+}
+
+bool RBPackReader::Stat(const std::string& fileName, mz_zip_archive_file_stat& stat)
+{
+	if (m_index) {
+		const RBPackIndex::Entry* entry = m_index->Find(fileName);
+		if (!entry) {
+			return false;
+		}
+		memset(&stat, 0, sizeof(stat));
+		stat.m_local_header_ofs = entry->localHeaderOffset;
+		stat.m_comp_size = entry->compSize;
+		stat.m_uncomp_size = entry->uncompSize;
+		stat.m_crc32 = entry->crc;
+		stat.m_method = entry->method;
+		stat.m_bit_flag = entry->bitFlag;
+		stat.m_is_directory = entry->isDirectory;
+		stat.m_is_encrypted = (entry->bitFlag & 1) != 0;
+		strncpy(stat.m_filename, entry->name.c_str(), sizeof(stat.m_filename) - 1);
+		return true;
+	}
+	mz_zip_archive* zip = Zip();
+	if (!zip) {
+		return false;
+	}
+	int i = mz_zip_reader_locate_file(zip, fileName.c_str(), nullptr, 0);
+	return i >= 0 && mz_zip_reader_file_stat(zip, i, &stat);
+}
+
+bool RBPackReader::Extract(const std::string& fileName, RBBufferPool::Buffer& data)
+{
+	if (m_index) {
+		const RBPackIndex::Entry* entry = m_index->Find(fileName);
+		if (!entry) {
+			m_zip.m_last_error = MZ_ZIP_FILE_NOT_FOUND;
+			return false;
+		}
+		if (ExtractIndexed(*entry, data)) {
+			ReleaseRanges(entry->localHeaderOffset, false);
+			return true;
+		}
+		// the pack does not match the index anymore or the entry is broken, miniz reads it again
+	}
+	mz_zip_archive* zip = Zip();
+	if (!zip) {
+		return false;
+	}
+	int i = mz_zip_reader_locate_file(zip, fileName.c_str(), nullptr, 0);
+	mz_zip_archive_file_stat stat;
+	if (i < 0 || !mz_zip_reader_file_stat(zip, i, &stat)) {
+		return false;
+	}
+	data = RBBufferPool::Shared().Acquire((size_t)stat.m_uncomp_size);
+	bool extracted = mz_zip_reader_extract_to_mem(zip, i, data.Data(), data.Size(), 0);
+	ReleaseRanges(stat.m_local_header_ofs, false);
+	return extracted;
+}
+
+bool RBPackReader::ExtractIndexed(const RBPackIndex::Entry& entry, RBBufferPool::Buffer& data)
+{
+	// encrypted entries and other compression methods are left to miniz
+	if (entry.isDirectory || (entry.bitFlag & 1) || (entry.method != 0 && entry.method != MZ_DEFLATED) || !Open()) {
+		return false;
+	}
+	mz_uint8 header[localHeaderSize];
+	if (ReadAt(entry.localHeaderOffset, header, localHeaderSize) != localHeaderSize || MZ_READ_LE32(header) != localHeaderSig) {
+		return false;
+	}
+	// the extra field of the local header can differ from the central one
+	uint64_t dataOffset = entry.localHeaderOffset + localHeaderSize + MZ_READ_LE16(header + 26) + MZ_READ_LE16(header + 28);
+	if (dataOffset > m_size || entry.compSize > m_size - dataOffset || (entry.method == 0 && entry.compSize != entry.uncompSize)) {
+		return false;
+	}
+	size_t compSize = (size_t)entry.compSize;
+	RBBufferPool::Buffer buffer;
+	const char* source = View(dataOffset, compSize);
+	if (!source) {
+		buffer = RBBufferPool::Shared().Acquire(compSize);
+		if (ReadAt(dataOffset, buffer.Data(), compSize) != compSize) {
+			return false;
+		}
+		source = buffer.Data();
+	}
+	data = RBBufferPool::Shared().Acquire((size_t)entry.uncompSize);
+	if (entry.method == 0) {
+		memcpy(data.Data(), source, compSize);
+	}
+	else if (!inflateRaw(reinterpret_cast<const unsigned char*>(source), compSize, reinterpret_cast<unsigned char*>(data.Data()), data.Size())) {
+		return false;
+	}
+	return zipCrc32(MZ_CRC32_INIT, data.Data(), data.Size()) == entry.crc;
+}
+
+void RBPackReader::ReadDirectories(const std::vector<RBPackReader*>& packs)
+{
+	if (s_mode != Mode::URING) {
+		return;
+	}
+	std::vector<Request> requests;
+	for (RBPackReader* pack : packs) {
+		// packs with an index do not need their central directory
+		if (!pack->m_directoryRead && !pack->m_index && pack->Open()) {
+			size_t size = (size_t)std::min<uint64_t>(pack->m_size, tailSize);
+			requests.push_back({ pack, pack->m_size - size, size, true });
+		}
+		pack->m_directoryRead = true;
+	}
+	ReadBatch(requests);
+
+	// central directories that do not fit into the tail, zip64 packs are left to miniz
+	std::vector<Request> directories;
+	for (const Request& request : requests) {
+		RBPackReader* pack = request.pack;
+		if (pack->m_ranges.empty() || pack->m_ranges.back().offset != request.offset) {
+			continue;
+		}
+		const RBBufferPool::Buffer& tail = pack->m_ranges.back().data;
+		for (size_t i = tail.Size() >= endOfCentralDirSize ? tail.Size() - endOfCentralDirSize + 1 : 0; i-- > 0;) {
+			const mz_uint8* record = reinterpret_cast<const mz_uint8*>(tail.Data()) + i;
+			if (MZ_READ_LE32(record) != endOfCentralDirSig) {
+				continue;
+			}
+			uint64_t size = MZ_READ_LE32(record + 12);
+			uint64_t offset = MZ_READ_LE32(record + 16);
+			if (offset < request.offset && offset + size <= pack->m_size) {
+				directories.push_back({ pack, offset, (size_t)size, true });
+			}
+			break;
+		}
+	}
+	ReadBatch(directories);
+}
+
+void RBPackReader::ReadEntries(const std::vector<std::pair<RBPackReader*, std::string>>& entries)
+{
+	if (s_mode != Mode::URING) {
+		return;
+	}
+	std::vector<Request> requests;
+	for (const auto& [pack, fileName] : entries) {
+		mz_zip_archive_file_stat stat;
+		// packs found through their index have not been opened yet
+		if (!pack->Open() || !pack->Stat(fileName, stat)) {
+			continue;
+		}
+		uint64_t size = localHeaderSize + strlen(stat.m_filename) + localExtraSize + stat.m_comp_size;
+		size = std::min(size, pack->m_size - std::min(pack->m_size, stat.m_local_header_ofs));
+		requests.push_back({ pack, stat.m_local_header_ofs, (size_t)size, false });
+	}
+	ReadBatch(requests);
+}
+
+void RBPackReader::ReadBatch(const std::vector<Request>& requests)
+{
+#ifdef RB_HAS_IO_URING
+	if (requests.empty()) {
+		return;
+	}
+	// buffers are only added to the packs once all reads are done
+	std::vector<Range> ranges(requests.size());
+	std::vector<bool> complete(requests.size(), false);
+	// set up once per thread, larger batches are submitted in parts
+	thread_local Uring ring(64);
+	if (ring.Valid()) {
+		for (size_t start = 0; start < requests.size(); start += ring.Entries()) {
+			size_t end = std::min<size_t>(requests.size(), start + ring.Entries());
+			for (size_t i = start; i < end; ++i) {
+				if (requests[i].size > maxBatchedRead) {
+					continue;
+				}
+				ranges[i].offset = requests[i].offset;
+				ranges[i].data = RBBufferPool::Shared().Acquire(requests[i].size);
+				ranges[i].directory = requests[i].directory;
+				ring.Read(requests[i].pack->m_fd, ranges[i].data.Data(), (unsigned)requests[i].size, requests[i].offset, i);
+			}
+			// failed and short reads are left to the reads of miniz
+			std::vector<bool> finished(end - start, false);
+			bool valid = ring.Complete([&](uint64_t i, int result) {
+				finished[i - start] = true;
+				complete[i] = result >= 0 && (size_t)result == requests[i].size;
+			});
+			if (!valid) {
+				// the kernel may still write into the buffers of unfinished reads, they are never given back to the pool;
+				// the ring is closed, so this and later batches are read with ReadAt
+				for (size_t i = start; i < end; ++i) {
+					if (ranges[i].data.Data() && !finished[i - start]) {
+						new RBBufferPool::Buffer(std::move(ranges[i].data));
+					}
+				}
+				break;
+			}
+		}
+	}
+	for (size_t i = 0; i < requests.size(); ++i) {
+		if (complete[i]) {
+			requests[i].pack->m_ranges.push_back(std::move(ranges[i]));
+		}
+	}
+#endif
+}
+
+size_t RBPackReader::Read(void* opaque, mz_uint64 offset, void* buffer, size_t n)
+{
+	return static_cast<RBPackReader*>(opaque)->ReadAt(offset, buffer, n);
+}
+
+const char* RBPackReader::View(uint64_t offset, size_t n) const
+{
+	if (m_mapping) {
+		return offset <= m_size && n <= m_size - offset ? static_cast<const char*>(m_mapping) + offset : nullptr;
+	}
+	for (const Range& range : m_ranges) {
+		if (offset >= range.offset && offset + n <= range.offset + range.data.Size()) {
+			return range.data.Data() + (offset - range.offset);
+		}
+	}
+	return nullptr;
+}
+
+void RBPackReader::ReleaseRanges(uint64_t entryOffset, bool directory)
+{
+	m_ranges.erase(std::remove_if(m_ranges.begin(), m_ranges.end(), [entryOffset, directory](const Range& range) {
+		return directory ? range.directory : !range.directory && range.offset == entryOffset;
+	}), m_ranges.end());
+}
+
+size_t RBPackReader::ReadAt(uint64_t offset, void* buffer, size_t n)
+{
+	if (const char* view = View(offset, n)) {
+		memcpy(buffer, view, n);
+		return n;
+	}
+	size_t total = 0;
+	while (total < n) {
+#ifdef _WIN32
+		uint64_t position = offset + total;
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = (DWORD)position;
+		overlapped.OffsetHigh = (DWORD)(position >> 32);
+		DWORD result = 0;
+		DWORD size = (DWORD)std::min<size_t>(n - total, 1 << 30);
+		if (!ReadFile(m_file, static_cast<char*>(buffer) + total, size, &result, &overlapped) || result == 0) {
+			break;
+		}
+#else
+		ssize_t result = pread(m_fd, static_cast<char*>(buffer) + total, n - total, offset + total);
+		if (result <= 0) {
+			break;
+		}
+#endif
+		total += result;
+	}
+	return total;
+}
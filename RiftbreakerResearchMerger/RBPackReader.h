@@ -0,0 +1,98 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "miniz/miniz.h"
+#include "RBBufferPool.h"
+#include "RBPackIndex.h"
+
+// Pack opened for reading with miniz through one of three I/O backends:
+// STDIO reads with the C file functions of miniz, MMAP maps the whole pack into memory and
+// URING (Linux only) reads the central directories and entries of many packs in batches with
+// io_uring, miniz then reads from the completed buffers. Reads that were not batched go to the file.
+// With an index of the pack, entries are found and extracted without reading the central directory.
+// A reader is used by one thread at a time.
+class RBPackReader
+{
+public:
+	enum class Mode {
+		STDIO,
+		MMAP,
+		URING,
+	};
+	// false if the mode is not supported here, io_uring needs Linux 5.6 and may be disabled
+	static bool SetMode(Mode mode);
+	static Mode GetMode() { return s_mode; }
+	static bool ParseMode(const std::string& name, Mode& mode);
+
+	RBPackReader(const std::filesystem::path& path, std::shared_ptr<const RBPackIndex> index = nullptr);
+	~RBPackReader();
+	RBPackReader(const RBPackReader&) = delete;
+	RBPackReader& operator=(const RBPackReader&) = delete;
+	const std::filesystem::path& GetPath() const { return m_path; }
+
+	// false if the pack can not be opened, the central directory is only read without an index
+	bool IsReadable();
+	// zip reader of the pack, initialized on first use, nullptr if the pack can not be read
+	mz_zip_archive* Zip();
+	mz_zip_error GetError() const { return m_zip.m_last_error; }
+	// false if the pack can not be read or has no such entry
+	bool Stat(const std::string& fileName, mz_zip_archive_file_stat& stat);
+	// false if the pack can not be read, has no such entry or the entry is broken,
+	// the entry is extracted into a buffer of the shared pool
+	bool Extract(const std::string& fileName, RBBufferPool::Buffer& data);
+
+	// reads the end of central directory records and the central directories of the packs,
+	// one batch for all packs and a second one for central directories that are not at the end
+	static void ReadDirectories(const std::vector<RBPackReader*>& packs);
+	// reads the local headers and data of the entries in one batch, missing entries are skipped
+	static void ReadEntries(const std::vector<std::pair<RBPackReader*, std::string>>& entries);
+private:
+	struct Range {
+		uint64_t offset = 0;
+		RBBufferPool::Buffer data;
+		// end of the pack or central directory, only needed until miniz read the directory
+		bool directory = false;
+	};
+	struct Request {
+		RBPackReader* pack;
+		uint64_t offset;
+		size_t size;
+		bool directory;
+	};
+	bool Open();
+	bool InitZip();
+	// reads the entry from its local header, false if the index does not match the pack
+	bool ExtractIndexed(const RBPackIndex::Entry& entry, RBBufferPool::Buffer& data);
+	// pointer to the range in the mapping or a batched buffer, nullptr if it has to be read
+	const char* View(uint64_t offset, size_t n) const;
+	size_t ReadAt(uint64_t offset, void* buffer, size_t n);
+	// drops the batched read of an entry once it is extracted, or of the directory once miniz has its own copy
+	void ReleaseRanges(uint64_t entryOffset, bool directory);
+	// reads the ranges into the buffers of their packs
+	static void ReadBatch(const std::vector<Request>& requests);
+	static size_t Read(void* opaque, mz_uint64 offset, void* buffer, size_t n);
+
+	std::filesystem::path m_path;
+	std::shared_ptr<const RBPackIndex> m_index;
+	bool m_opened = false;
+	bool m_valid = false;
+	bool m_directoryRead = false;
+	bool m_zipInit = false;
+	bool m_zipValid = false;
+	mz_zip_archive m_zip;
+	uint64_t m_size = 0;
+	void* m_mapping = nullptr;
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mappingHandle = nullptr;
+#else
+	int m_fd = -1;
+#endif
+	std::vector<Range> m_ranges;
+
+	static Mode s_mode;
+};
@@ -0,0 +1,65 @@
+#include "RBWriteBuffer.h"
+#include <cstring>
+
+// longest run of tabs written with a single copy, deeper indents take several
+static const char indentRun[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+static const int indentRunLength = sizeof(indentRun) - 1;
+
+void RBWriteBuffer::Reserve(size_t capacity)
+{
+	if (capacity > m_capacity) {
+		std::unique_ptr<char[]> data(new char[capacity]);
+		if (m_size > 0) {
+			memcpy(data.get(), m_data.get(), m_size);
+		}
+		m_data = std::move(data);
+		m_capacity = capacity;
+	}
+}
+
+void RBWriteBuffer::SetFlush(size_t flushSize, std::function<void(const char*, size_t)> flush)
+{
+	m_flushSize = flushSize;
+	m_flush = flush;
+	Reserve(flushSize);
+}
+
+void RBWriteBuffer::Flush()
+{
+	if (m_flush && m_size > 0) {
+		m_flush(m_data.get(), m_size);
+		m_size = 0;
+	}
+}
+
+void RBWriteBuffer::Grow(size_t minCapacity)
+{
+	size_t capacity = m_capacity < 4096 ? 4096 : m_capacity * 2;
+	while (capacity < minCapacity) {
+		capacity *= 2;
+	}
+	Reserve(capacity);
+}
+
+void RBWriteBuffer::Append(const char* data, size_t length)
+{
+	if (m_size + length > m_capacity) {
+		Grow(m_size + length);
+	}
+	memcpy(m_data.get() + m_size, data, length);
+	m_size += length;
+	if (m_flushSize > 0 && m_size >= m_flushSize) {
+		Flush();
+	}
+}
+
+void RBWriteBuffer::AppendIndent(int indent)
+{
+	while (indent > indentRunLength) {
+		Append(indentRun, indentRunLength);
+		indent -= indentRunLength;
+	}
+	if (indent > 0) {
+		Append(indentRun, indent);
+	}
+}
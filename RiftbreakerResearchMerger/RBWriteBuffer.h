@@ -0,0 +1,31 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <string>
+
+// Growable contiguous output buffer for serializing nodes.
+// With a flush callback set the buffer is handed over and emptied whenever it reaches the flush size.
+class RBWriteBuffer
+{
+public:
+	RBWriteBuffer() : m_size(0), m_capacity(0), m_flushSize(0) {}
+	void Reserve(size_t capacity);
+	void Clear() { m_size = 0; }
+	void SetFlush(size_t flushSize, std::function<void(const char*, size_t)> flush);
+	// passes the buffered data to the flush callback and empties the buffer
+	void Flush();
+	void Append(const char* data, size_t length);
+	void Append(const std::string& data) { Append(data.data(), data.size()); }
+	void Append(char c) { if (m_size == m_capacity) Grow(m_size + 1); m_data[m_size++] = c; if (m_size == m_flushSize) Flush(); }
+	void AppendIndent(int indent);
+	const char* Data() const { return m_data.get(); }
+	size_t Size() const { return m_size; }
+	std::string Str() const { return std::string(m_data.get(), m_size); }
+private:
+	void Grow(size_t minCapacity);
+	std::unique_ptr<char[]> m_data;
+	size_t m_size;
+	size_t m_capacity;
+	size_t m_flushSize;
+	std::function<void(const char*, size_t)> m_flush;
+};
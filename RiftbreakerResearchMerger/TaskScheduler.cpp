@@ -0,0 +1,185 @@
+#include "TaskScheduler.h"
+#include <algorithm>
+#include <string>
+#include "Trace.h"
+
+std::shared_ptr<TaskScheduler> TaskScheduler::s_global;
+
+// queue of the current thread, 0 is shared by all threads that are not workers
+static thread_local size_t t_queueIndex = 0;
+static const std::string taskTraceName("task");
+
+TaskScheduler::TaskScheduler(size_t numThreads, size_t parallelThreshold)
+	: m_numTasks(0), m_stop(false), m_parallelThreshold(std::max<size_t>(parallelThreshold, 1))
+{
+	numThreads = std::max<size_t>(numThreads, 1);
+	for (size_t i = 0; i < numThreads; ++i) {
+		m_queues.push_back(std::make_unique<TaskQueue>());
+	}
+	for (size_t i = 1; i < numThreads; ++i) {
+		m_workers.emplace_back(&TaskScheduler::WorkerLoop, this, i);
+	}
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_wakeMutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (auto& worker : m_workers) {
+		worker.join();
+	}
+}
+
+void TaskScheduler::Submit(std::function<void()> task)
+{
+	size_t index = t_queueIndex < m_queues.size() ? t_queueIndex : 0;
+	{
+		std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+		m_queues[index]->tasks.push_back(std::move(task));
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_wakeMutex);
+		++m_numTasks;
+	}
+	m_wake.notify_one();
+}
+
+bool TaskScheduler::RunOne()
+{
+	size_t index = t_queueIndex < m_queues.size() ? t_queueIndex : 0;
+	std::function<void()> task;
+	if (!Pop(index, task) && !Steal(index, task)) {
+		return false;
+	}
+	--m_numTasks;
+	TraceScope trace("task", taskTraceName);
+	task();
+	return true;
+}
+
+void TaskScheduler::WaitForWork(const std::function<bool()>& done)
+{
+	std::unique_lock<std::mutex> lock(m_wakeMutex);
+	m_wake.wait(lock, [this, &done] { return m_stop || m_numTasks > 0 || done(); });
+}
+
+void TaskScheduler::Notify()
+{
+	// a waiter has either not checked done() yet or is already waiting once the lock is free
+	{
+		std::lock_guard<std::mutex> lock(m_wakeMutex);
+	}
+	m_wake.notify_all();
+}
+
+void TaskScheduler::WorkerLoop(size_t index)
+{
+	t_queueIndex = index;
+	Trace::SetThreadName("worker " + std::to_string(index));
+	while (true) {
+		if (RunOne()) {
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(m_wakeMutex);
+		m_wake.wait(lock, [this] { return m_stop || m_numTasks > 0; });
+		if (m_stop) {
+			return;
+		}
+	}
+}
+
+bool TaskScheduler::Pop(size_t index, std::function<void()>& task)
+{
+	// own tasks newest first, they are most likely still in cache
+	TaskQueue& queue = *m_queues[index];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.tasks.empty()) {
+		return false;
+	}
+	task = std::move(queue.tasks.back());
+	queue.tasks.pop_back();
+	return true;
+}
+
+bool TaskScheduler::Steal(size_t index, std::function<void()>& task)
+{
+	// oldest tasks of other queues, they are usually the largest
+	for (size_t i = 1; i < m_queues.size(); ++i) {
+		TaskQueue& queue = *m_queues[(index + i) % m_queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.tasks.empty()) {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+TaskGroup::~TaskGroup()
+{
+	// tasks reference the group, never leave them running
+	WaitPending();
+}
+
+void TaskGroup::Run(std::function<void()> task)
+{
+	++m_pending;
+	m_scheduler->Submit([this, task, scheduler = m_scheduler.get()]() {
+		try {
+			task();
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(m_exceptionMutex);
+			if (!m_exception) {
+				m_exception = std::current_exception();
+			}
+		}
+		// the group can be gone as soon as the waiting thread sees no pending tasks, only the scheduler is used after
+		if (--m_pending == 0) {
+			scheduler->Notify();
+		}
+	});
+}
+
+void TaskGroup::Wait()
+{
+	WaitPending();
+	if (m_exception) {
+		std::exception_ptr exception = m_exception;
+		m_exception = nullptr;
+		std::rethrow_exception(exception);
+	}
+}
+
+void TaskGroup::WaitPending()
+{
+	while (m_pending > 0) {
+		if (!m_scheduler->RunOne()) {
+			// nothing to help with, sleeps until a task is queued or the last task of the group is done
+			m_scheduler->WaitForWork([this] { return m_pending == 0; });
+		}
+	}
+}
+
+void parallelFor(size_t count, const std::function<void(size_t, size_t)>& body)
+{
+	std::shared_ptr<TaskScheduler> scheduler = TaskScheduler::Global();
+	if (!scheduler || scheduler->NumThreads() < 2 || count < scheduler->ParallelThreshold()) {
+		body(0, count);
+		return;
+	}
+
+	// a few chunks per thread so stealing can balance uneven subtrees
+	size_t numChunks = std::min(count, scheduler->NumThreads() * 4);
+	TaskGroup group(scheduler);
+	for (size_t chunk = 0; chunk < numChunks; ++chunk) {
+		size_t begin = count * chunk / numChunks;
+		size_t end = count * (chunk + 1) / numChunks;
+		group.Run([&body, begin, end]() { body(begin, end); });
+	}
+	group.Wait();
+}
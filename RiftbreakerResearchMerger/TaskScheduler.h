@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Every worker owns a task queue, runs its own tasks newest first
+// and steals the oldest tasks of other queues when it runs out of work.
+class TaskScheduler
+{
+public:
+	// numThreads includes the calling thread, which helps while waiting on a TaskGroup
+	TaskScheduler(size_t numThreads, size_t parallelThreshold);
+	~TaskScheduler();
+	void Submit(std::function<void()> task);
+	// runs one queued task on the calling thread, returns false if there was none
+	bool RunOne();
+	// blocks until done() holds or a task is queued, instead of spinning on RunOne()
+	void WaitForWork(const std::function<bool()>& done);
+	// wakes the threads in WaitForWork(), called after the state their done() checks changed
+	void Notify();
+	size_t NumThreads() const { return m_queues.size(); }
+	size_t ParallelThreshold() const { return m_parallelThreshold; }
+
+	// scheduler used by the merge code, nullptr runs everything on the calling thread
+	static void SetGlobal(std::shared_ptr<TaskScheduler> scheduler) { s_global = scheduler; }
+	static std::shared_ptr<TaskScheduler> Global() { return s_global; }
+private:
+	struct TaskQueue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+	void WorkerLoop(size_t index);
+	bool Pop(size_t index, std::function<void()>& task);
+	bool Steal(size_t index, std::function<void()>& task);
+
+	std::vector<std::unique_ptr<TaskQueue>> m_queues;
+	std::vector<std::thread> m_workers;
+	std::atomic<size_t> m_numTasks;
+	std::mutex m_wakeMutex;
+	std::condition_variable m_wake;
+	bool m_stop;
+	size_t m_parallelThreshold;
+
+	static std::shared_ptr<TaskScheduler> s_global;
+};
+
+// Set of tasks that can be waited on. Wait() runs queued tasks and only blocks while there are none,
+// so groups can be nested inside tasks. The first exception of a task is rethrown by Wait().
+class TaskGroup
+{
+public:
+	TaskGroup(std::shared_ptr<TaskScheduler> scheduler) : m_scheduler(scheduler), m_pending(0) {}
+	~TaskGroup();
+	void Run(std::function<void()> task);
+	void Wait();
+private:
+	void WaitPending();
+
+	std::shared_ptr<TaskScheduler> m_scheduler;
+	std::atomic<size_t> m_pending;
+	std::mutex m_exceptionMutex;
+	std::exception_ptr m_exception;
+};
+
+// Calls body(begin, end) for chunks of [0, count). The chunks run in parallel on the global
+// scheduler if count reaches its parallel threshold, else body(0, count) runs on the calling thread.
+void parallelFor(size_t count, const std::function<void(size_t, size_t)>& body);
@@ -0,0 +1,251 @@
+#include "Timings.h"
+#include "MemoryReport.h"
+#include "Trace.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <ctime>
+#endif
+
+bool Timings::s_enabled = false;
+
+static const char* phaseNames[] = { "discovery", "open", "extract", "parse", "remove_equal", "merge", "serialize", "compress", "write" };
+
+struct PhaseTime {
+	double wall = 0.0;
+	double cpu = 0.0;
+	size_t count = 0;
+};
+
+struct PhaseTimes {
+	PhaseTime phases[static_cast<int>(TimingPhase::COUNT)];
+};
+
+struct FileTimings {
+	std::string file;
+	PhaseTimes total;
+	std::map<std::string, PhaseTimes> packs;
+};
+
+static std::mutex s_mutex;
+// in the order the files were merged
+static std::vector<FileTimings> s_files;
+static thread_local std::string t_file;
+static thread_local TimingScope* t_scope = nullptr;
+
+const char* Timings::PhaseName(TimingPhase phase)
+{
+	return phaseNames[static_cast<int>(phase)];
+}
+
+void Timings::SetFile(const std::string& file)
+{
+	t_file = file;
+}
+
+const std::string& Timings::CurrentFile()
+{
+	return t_file;
+}
+
+void Timings::Record(TimingPhase phase, const std::string& pack, double wallSeconds, double cpuSeconds)
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	auto file = std::find_if(s_files.begin(), s_files.end(), [](const FileTimings& timings) { return timings.file == t_file; });
+	if (file == s_files.end()) {
+		s_files.emplace_back();
+		s_files.back().file = t_file;
+		file = s_files.end() - 1;
+	}
+	std::vector<PhaseTime*> times{ &file->total.phases[static_cast<int>(phase)] };
+	if (!pack.empty()) {
+		times.push_back(&file->packs[pack].phases[static_cast<int>(phase)]);
+	}
+	for (PhaseTime* time : times) {
+		time->wall += wallSeconds;
+		time->cpu += cpuSeconds;
+		++time->count;
+	}
+}
+
+void Timings::Reset()
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	s_files.clear();
+}
+
+double Timings::ThreadCpuSeconds()
+{
+#ifdef _WIN32
+	FILETIME creation, exitTime, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exitTime, &kernel, &user)) {
+		return 0.0;
+	}
+	ULARGE_INTEGER kernelTime, userTime;
+	kernelTime.LowPart = kernel.dwLowDateTime;
+	kernelTime.HighPart = kernel.dwHighDateTime;
+	userTime.LowPart = user.dwLowDateTime;
+	userTime.HighPart = user.dwHighDateTime;
+	return (kernelTime.QuadPart + userTime.QuadPart) * 1e-7;
+#else
+	timespec time;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+}
+
+static std::string formatMs(double wall, double cpu)
+{
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(1) << wall * 1000.0 << "/" << cpu * 1000.0;
+	return ss.str();
+}
+
+static void printPhases(std::ostream& out, const std::string& name, const PhaseTimes& times)
+{
+	out << "  " << std::left << std::setw(24) << name << std::right;
+	double wall = 0.0;
+	double cpu = 0.0;
+	for (const auto& time : times.phases) {
+		out << std::setw(13) << (time.count > 0 ? formatMs(time.wall, time.cpu) : std::string("-"));
+		wall += time.wall;
+		cpu += time.cpu;
+	}
+	out << std::setw(15) << formatMs(wall, cpu) << std::endl;
+}
+
+void Timings::PrintSummary(std::ostream& out)
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	out << std::endl << "Timings in ms, wall/cpu:" << std::endl;
+	out << "  " << std::left << std::setw(24) << "" << std::right;
+	for (const char* name : phaseNames) {
+		out << std::setw(13) << name;
+	}
+	out << std::setw(15) << "total" << std::endl;
+
+	PhaseTimes total;
+	for (const auto& file : s_files) {
+		out << (file.file.empty() ? std::string("(other)") : file.file) << std::endl;
+		printPhases(out, "all", file.total);
+		for (const auto& [pack, times] : file.packs) {
+			printPhases(out, pack, times);
+		}
+		for (int i = 0; i < static_cast<int>(TimingPhase::COUNT); ++i) {
+			total.phases[i].wall += file.total.phases[i].wall;
+			total.phases[i].cpu += file.total.phases[i].cpu;
+			total.phases[i].count += file.total.phases[i].count;
+		}
+	}
+	out << "Total" << std::endl;
+	printPhases(out, "all", total);
+}
+
+void Timings::WriteJsonString(std::ostream& out, const std::string& value)
+{
+	out << '"';
+	for (char c : value) {
+		if (c == '"' || c == '\\') {
+			out << '\\' << c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20) {
+			out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec << std::setfill(' ');
+		}
+		else {
+			out << c;
+		}
+	}
+	out << '"';
+}
+
+static void writeJsonPhases(std::ostream& out, const PhaseTimes& times)
+{
+	out << "{";
+	bool first = true;
+	for (int i = 0; i < static_cast<int>(TimingPhase::COUNT); ++i) {
+		const PhaseTime& time = times.phases[i];
+		if (time.count == 0) {
+			continue;
+		}
+		out << (first ? "" : ", ") << "\"" << phaseNames[i] << "\": {\"wall_ms\": " << time.wall * 1000.0 << ", \"cpu_ms\": " << time.cpu * 1000.0 << ", \"count\": " << time.count << "}";
+		first = false;
+	}
+	out << "}";
+}
+
+bool Timings::WriteJson(const std::filesystem::path& path)
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	std::ofstream out(path);
+	if (!out) {
+		return false;
+	}
+	out << std::fixed << std::setprecision(3);
+	out << "{\n  \"files\": [";
+	for (size_t i = 0; i < s_files.size(); ++i) {
+		const FileTimings& file = s_files[i];
+		out << (i > 0 ? "," : "") << "\n    {\"file\": ";
+		WriteJsonString(out, file.file);
+		out << ", \"phases\": ";
+		writeJsonPhases(out, file.total);
+		out << ", \"packs\": [";
+		bool first = true;
+		for (const auto& [pack, times] : file.packs) {
+			out << (first ? "" : ", ") << "{\"pack\": ";
+			WriteJsonString(out, pack);
+			out << ", \"phases\": ";
+			writeJsonPhases(out, times);
+			out << "}";
+			first = false;
+		}
+		out << "]}";
+	}
+	out << "\n  ]\n}\n";
+	return out.good();
+}
+
+TimingScope::TimingScope(TimingPhase phase, const std::string& pack)
+	: m_active(Timings::Enabled() || MemoryReport::Enabled() || Trace::Enabled()), m_phase(phase), m_cpuStart(0.0), m_childWall(0.0), m_childCpu(0.0), m_parent(nullptr)
+{
+	if (!m_active) {
+		return;
+	}
+	m_pack = pack;
+	m_parent = t_scope;
+	t_scope = this;
+	m_wallStart = std::chrono::steady_clock::now();
+	m_cpuStart = Timings::ThreadCpuSeconds();
+}
+
+TimingScope::~TimingScope()
+{
+	if (!m_active) {
+		return;
+	}
+	auto wallEnd = std::chrono::steady_clock::now();
+	double wall = std::chrono::duration<double>(wallEnd - m_wallStart).count();
+	double cpu = Timings::ThreadCpuSeconds() - m_cpuStart;
+	t_scope = m_parent;
+	if (m_parent) {
+		m_parent->m_childWall += wall;
+		m_parent->m_childCpu += cpu;
+	}
+	if (Timings::Enabled()) {
+		Timings::Record(m_phase, m_pack, wall - m_childWall, cpu - m_childCpu);
+	}
+	if (MemoryReport::Enabled()) {
+		MemoryReport::RecordPhase(m_phase);
+	}
+	if (Trace::Enabled()) {
+		Trace::Record("phase", Timings::PhaseName(m_phase), t_file, m_pack, m_wallStart, wallEnd);
+	}
+}
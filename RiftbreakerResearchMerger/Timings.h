@@ -0,0 +1,61 @@
+#pragma once
+#include <chrono>
+#include <filesystem>
+#include <ostream>
+#include <string>
+
+enum class TimingPhase {
+	DISCOVERY = 0,
+	OPEN = 1,
+	EXTRACT = 2,
+	PARSE = 3,
+	REMOVE_EQUAL = 4,
+	MERGE = 5,
+	SERIALIZE = 6,
+	COMPRESS = 7,
+	WRITE = 8,
+	COUNT = 9,
+};
+
+// Wall and CPU time per phase of every merged file and mod pack, collected when -timings is set.
+// CPU time is the time of the thread that ran the phase, so waiting for other threads does not count as CPU.
+class Timings
+{
+public:
+	static void Enable() { s_enabled = true; }
+	static bool Enabled() { return s_enabled; }
+	// file that the following phases on this thread are recorded for
+	static void SetFile(const std::string& file);
+	static const std::string& CurrentFile();
+	static void Record(TimingPhase phase, const std::string& pack, double wallSeconds, double cpuSeconds);
+	static void PrintSummary(std::ostream& out);
+	static bool WriteJson(const std::filesystem::path& path);
+	// forgets the recorded times, -watch reports every merge on its own
+	static void Reset();
+	// CPU time used by the calling thread
+	static double ThreadCpuSeconds();
+	static const char* PhaseName(TimingPhase phase);
+	static void WriteJsonString(std::ostream& out, const std::string& value);
+private:
+	static bool s_enabled;
+};
+
+// Times a phase until the end of the scope. Time spent in nested scopes is only counted for them.
+// Also samples the memory use at the end of the phase for the -memory report and records a -trace span.
+class TimingScope
+{
+public:
+	TimingScope(TimingPhase phase, const std::string& pack = std::string());
+	~TimingScope();
+	TimingScope(const TimingScope&) = delete;
+	TimingScope& operator=(const TimingScope&) = delete;
+private:
+	bool m_active;
+	TimingPhase m_phase;
+	std::string m_pack;
+	std::chrono::steady_clock::time_point m_wallStart;
+	double m_cpuStart;
+	double m_childWall;
+	double m_childCpu;
+	TimingScope* m_parent;
+};
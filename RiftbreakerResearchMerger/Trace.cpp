@@ -0,0 +1,124 @@
+#include "Trace.h"
+#include "Timings.h"
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+bool Trace::s_enabled = false;
+
+struct TraceEvent {
+	const char* category;
+	std::string name;
+	std::string file;
+	std::string pack;
+	int64_t start;
+	int64_t duration;
+};
+
+struct TraceThread {
+	size_t id;
+	std::string name;
+	std::vector<TraceEvent> events;
+};
+
+static std::chrono::steady_clock::time_point s_epoch;
+static std::mutex s_mutex;
+// owned here so the events outlive the worker threads
+static std::vector<std::unique_ptr<TraceThread>> s_threads;
+static thread_local TraceThread* t_thread = nullptr;
+
+static TraceThread& currentThread()
+{
+	if (!t_thread) {
+		std::lock_guard<std::mutex> lock(s_mutex);
+		s_threads.push_back(std::make_unique<TraceThread>());
+		t_thread = s_threads.back().get();
+		t_thread->id = s_threads.size();
+		t_thread->events.reserve(1024);
+	}
+	return *t_thread;
+}
+
+static int64_t microseconds(std::chrono::steady_clock::duration duration)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+}
+
+void Trace::Enable()
+{
+	s_epoch = std::chrono::steady_clock::now();
+	s_enabled = true;
+}
+
+void Trace::SetThreadName(const std::string& name)
+{
+	if (s_enabled) {
+		currentThread().name = name;
+	}
+}
+
+void Trace::Record(const char* category, const std::string& name, const std::string& file, const std::string& pack,
+	std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+	currentThread().events.push_back({ category, name, file, pack, microseconds(start - s_epoch), microseconds(end - start) });
+}
+
+bool Trace::Write(const std::filesystem::path& path)
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	std::ofstream out(path);
+	if (!out) {
+		return false;
+	}
+	out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+	bool first = true;
+	for (const auto& thread : s_threads) {
+		if (!thread->name.empty()) {
+			out << (first ? "" : ",") << "\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread->id << ", \"args\": {\"name\": ";
+			Timings::WriteJsonString(out, thread->name);
+			out << "}}";
+			first = false;
+		}
+		for (const TraceEvent& event : thread->events) {
+			out << (first ? "" : ",") << "\n{\"name\": ";
+			Timings::WriteJsonString(out, event.name);
+			out << ", \"cat\": \"" << event.category << "\", \"ph\": \"X\", \"ts\": " << event.start << ", \"dur\": " << event.duration
+				<< ", \"pid\": 1, \"tid\": " << thread->id << ", \"args\": {\"file\": ";
+			Timings::WriteJsonString(out, event.file);
+			out << ", \"pack\": ";
+			Timings::WriteJsonString(out, event.pack);
+			out << "}}";
+			first = false;
+		}
+	}
+	out << "\n]}\n";
+	return out.good();
+}
+
+void Trace::Reset()
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	for (const auto& thread : s_threads) {
+		thread->events.clear();
+	}
+	s_epoch = std::chrono::steady_clock::now();
+}
+
+TraceScope::TraceScope(const char* category, const std::string& name, const std::string& pack)
+	: m_active(Trace::Enabled()), m_category(category)
+{
+	if (!m_active) {
+		return;
+	}
+	m_name = name;
+	m_pack = pack;
+	m_start = std::chrono::steady_clock::now();
+}
+
+TraceScope::~TraceScope()
+{
+	if (m_active) {
+		Trace::Record(m_category, m_name, Timings::CurrentFile(), m_pack, m_start, std::chrono::steady_clock::now());
+	}
+}
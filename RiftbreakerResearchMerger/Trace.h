@@ -0,0 +1,39 @@
+#pragma once
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+// Chrome trace event recorder, enabled with -trace. Every thread appends complete events to its own
+// buffer, so recording takes no lock; the buffers are written as one trace file after the merge.
+// Open the file in chrome://tracing or https://ui.perfetto.dev.
+class Trace
+{
+public:
+	static void Enable();
+	static bool Enabled() { return s_enabled; }
+	// name shown for the calling thread
+	static void SetThreadName(const std::string& name);
+	static void Record(const char* category, const std::string& name, const std::string& file, const std::string& pack,
+		std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+	static bool Write(const std::filesystem::path& path);
+	// drops the recorded events and starts the time over, no thread may be recording meanwhile
+	static void Reset();
+private:
+	static bool s_enabled;
+};
+
+// Records a span from construction to the end of the scope when tracing is enabled.
+class TraceScope
+{
+public:
+	TraceScope(const char* category, const std::string& name, const std::string& pack = std::string());
+	~TraceScope();
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+private:
+	bool m_active;
+	const char* m_category;
+	std::string m_name;
+	std::string m_pack;
+	std::chrono::steady_clock::time_point m_start;
+};
@@ -0,0 +1,177 @@
+#include "Tests.h"
+#include "RBBinaryPatch.h"
+#include "RBMergeRegistry.h"
+#include <sstream>
+
+static const char* baseText = R"(Research
+{
+	categories
+	{
+		ResearchTree
+		{
+			category "cat_0"
+			nodes
+			{
+				ResearchNode
+				{
+					research_name "node_a"
+					research_awards
+					{
+						ResearchAward
+						{
+							blueprint "bp/a"
+							is_visible "1"
+						}
+					}
+					position
+					{
+						x "0"
+						y "-3"
+					}
+				}
+				ResearchNode
+				{
+					research_name "node_b"
+					position
+					{
+						x "1"
+						y "0"
+					}
+				}
+			}
+		}
+	}
+}
+)";
+
+// changes node_b, adds node_c and a tree, values that only look like numbers stay strings
+static const char* patchText = R"(Research
+{
+	categories
+	{
+		ResearchTree
+		{
+			category "cat_0"
+			nodes
+			{
+				ResearchNode
+				{
+					research_name "node_b"
+					position
+					{
+						x "12"
+						y "-4096"
+					}
+					flag_empty
+				}
+				ResearchNode
+				{
+					research_name "node_c"
+					localization_id "007"
+					research_awards
+					{
+						ResearchAward
+						{
+							blueprint "bp/c"
+							is_visible "-0"
+							count "123456789012345678"
+							scale "1.5"
+						}
+					}
+				}
+			}
+		}
+		ResearchTree
+		{
+			category "cat_1"
+			nodes
+			{
+			}
+		}
+	}
+}
+)";
+
+static std::shared_ptr<RBMergeRules> researchRules()
+{
+	auto rules = RBMergeRegistry::Builtin()->Find("scripts/research/research_tree.rt");
+	CHECK(rules != nullptr);
+	return rules;
+}
+
+static std::shared_ptr<RBFile> parse(const char* text)
+{
+	std::istringstream in(text);
+	return std::make_shared<RBFile>(in);
+}
+
+static std::string serialize(std::shared_ptr<RBFile> file)
+{
+	std::ostringstream out;
+	file->Serialize(out);
+	return out.str();
+}
+
+TEST(binaryPatchRoundTrip)
+{
+	auto rules = researchRules();
+	auto textPatch = parse(patchText);
+	std::string binary = writeBinaryPatch(textPatch, 0x12345678, 1000, rules);
+	auto binaryPatch = readBinaryPatch(binary.data(), binary.size(), 0x12345678, 1000, rules);
+	CHECK(binaryPatch != nullptr);
+	CHECK(serialize(binaryPatch) == serialize(textPatch));
+}
+
+TEST(binaryPatchMergesLikeTextPatch)
+{
+	auto rules = researchRules();
+	auto textPatch = parse(patchText);
+	std::string binary = writeBinaryPatch(textPatch, 1, 2, rules);
+	auto binaryPatch = readBinaryPatch(binary.data(), binary.size(), 1, 2, rules);
+	CHECK(binaryPatch != nullptr);
+
+	auto mergedText = parse(baseText);
+	mergedText->Merge(textPatch, rules);
+	auto mergedBinary = parse(baseText);
+	mergedBinary->Merge(binaryPatch, rules);
+	CHECK(serialize(mergedBinary) == serialize(mergedText));
+	CHECK(serialize(mergedText).find("node_c") != std::string::npos);
+}
+
+TEST(binaryPatchStale)
+{
+	auto rules = researchRules();
+	std::string binary = writeBinaryPatch(parse(patchText), 1, 2, rules);
+	// another text patch or other rules
+	CHECK(readBinaryPatch(binary.data(), binary.size(), 3, 2, rules) == nullptr);
+	CHECK(readBinaryPatch(binary.data(), binary.size(), 1, 3, rules) == nullptr);
+	CHECK(readBinaryPatch(binary.data(), binary.size(), 1, 2, RBMergeRegistry::Builtin()->Find("scripts/research/research_tree.rt")) != nullptr);
+	auto otherRules = std::make_shared<RBMergeRules>(std::make_shared<RBMergeRule>("", RBMergeType::RBMERGE_DICT, "",
+		RBMergeRuleNew::RBMERGE_ADD, RBMergeRuleRemoved::RBMERGE_IGNORE, RBMergeRuleShared::RBMERGE_REPLACE));
+	CHECK(readBinaryPatch(binary.data(), binary.size(), 1, 2, otherRules) == nullptr);
+}
+
+TEST(binaryPatchMalformed)
+{
+	auto rules = researchRules();
+	std::string binary = writeBinaryPatch(parse(patchText), 1, 2, rules);
+	for (size_t size = 0; size < binary.size(); ++size) {
+		bool threw = false;
+		try {
+			readBinaryPatch(binary.data(), size, 1, 2, rules);
+		}
+		catch (const std::runtime_error&) {
+			threw = true;
+		}
+		CHECK(threw);
+	}
+	std::string trailing = binary + '\0';
+	bool threw = false;
+	try {
+		readBinaryPatch(trailing.data(), trailing.size(), 1, 2, rules);
+	}
+	catch (const std::runtime_error&) {
+		threw = true;
+	}
+	CHECK(threw);
+}
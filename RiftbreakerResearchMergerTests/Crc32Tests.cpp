@@ -0,0 +1,55 @@
+#include "Tests.h"
+#include "RBCrc32.h"
+#include "miniz/miniz.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+static std::vector<unsigned char> randomBytes(size_t size, unsigned seed)
+{
+	std::mt19937 rng(seed);
+	std::vector<unsigned char> data(size);
+	for (unsigned char& byte : data) {
+		byte = (unsigned char)rng();
+	}
+	return data;
+}
+
+TEST(zipCrc32KnownValues)
+{
+	CHECK(zipCrc32(MZ_CRC32_INIT, nullptr, 0) == 0);
+	CHECK(zipCrc32(MZ_CRC32_INIT, "123456789", 9) == 0xCBF43926);
+	CHECK(zipCrc32(MZ_CRC32_INIT, "a", 1) == 0xE8B7BE43);
+}
+
+TEST(zipCrc32MatchesMiniz)
+{
+	std::vector<unsigned char> data = randomBytes(1 << 18, 1);
+	std::mt19937 rng(2);
+	// every length around the 16 and 64 byte steps of the folding, at every alignment
+	for (size_t length = 0; length < 300; ++length) {
+		for (size_t offset = 0; offset < 16; ++offset) {
+			CHECK(zipCrc32(MZ_CRC32_INIT, data.data() + offset, length) == (uint32_t)mz_crc32(MZ_CRC32_INIT, data.data() + offset, length));
+		}
+	}
+	for (int i = 0; i < 2000; ++i) {
+		size_t offset = rng() % 4096;
+		size_t length = rng() % (data.size() - offset);
+		uint32_t start = i % 3 == 0 ? (uint32_t)rng() : MZ_CRC32_INIT;
+		CHECK(zipCrc32(start, data.data() + offset, length) == (uint32_t)mz_crc32(start, data.data() + offset, length));
+	}
+}
+
+TEST(zipCrc32Chained)
+{
+	// written in chunks like the flushes of RBWriteBuffer
+	std::vector<unsigned char> data = randomBytes(1 << 20, 3);
+	std::mt19937 rng(4);
+	uint32_t crc = MZ_CRC32_INIT;
+	for (size_t pos = 0; pos < data.size();) {
+		size_t length = std::min<size_t>(rng() % 5000, data.size() - pos);
+		crc = zipCrc32(crc, data.data() + pos, length);
+		pos += length;
+	}
+	CHECK(crc == (uint32_t)mz_crc32(MZ_CRC32_INIT, data.data(), data.size()));
+}
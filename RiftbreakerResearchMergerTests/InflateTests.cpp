@@ -0,0 +1,114 @@
+#include "Tests.h"
+#include "RBInflate.h"
+#include "miniz/miniz.h"
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// raw deflate stream of data written by miniz with the given level and strategy
+static std::vector<unsigned char> deflateWithMiniz(const std::vector<unsigned char>& data, int level, int strategy)
+{
+	mz_uint flags = tdefl_create_comp_flags_from_zip_params(level, -MZ_DEFAULT_WINDOW_BITS, strategy);
+	size_t compressedSize = 0;
+	void* compressed = tdefl_compress_mem_to_heap(data.data(), data.size(), &compressedSize, (int)flags);
+	CHECK(compressed != nullptr || data.empty());
+	std::vector<unsigned char> result(static_cast<unsigned char*>(compressed), static_cast<unsigned char*>(compressed) + compressedSize);
+	mz_free(compressed);
+	return result;
+}
+
+static std::vector<unsigned char> randomBytes(size_t size, unsigned seed)
+{
+	std::mt19937 rng(seed);
+	std::vector<unsigned char> data(size);
+	for (unsigned char& byte : data) {
+		byte = (unsigned char)rng();
+	}
+	return data;
+}
+
+// text like the research trees, long matches at many distances
+static std::vector<unsigned char> researchText(size_t numNodes)
+{
+	std::string text = "Research\n{\n";
+	for (size_t i = 0; i < numNodes; ++i) {
+		text += "\tResearchNode\n\t{\n\t\tresearch_name \"node_" + std::to_string(i) + "\"\n";
+		text += "\t\tcount \"" + std::to_string(i * 7919 % 1000) + "\"\n\t}\n\n";
+	}
+	text += "}\n";
+	return std::vector<unsigned char>(text.begin(), text.end());
+}
+
+static void checkInflatesLikeMiniz(const std::vector<unsigned char>& data)
+{
+	const int levels[] = { 0, 1, 6, 9, 10 };
+	const int strategies[] = { MZ_DEFAULT_STRATEGY, MZ_FIXED, MZ_HUFFMAN_ONLY, MZ_RLE };
+	for (int level : levels) {
+		for (int strategy : strategies) {
+			std::vector<unsigned char> compressed = deflateWithMiniz(data, level, strategy);
+			std::vector<unsigned char> expected(data.size());
+			CHECK(tinfl_decompress_mem_to_mem(expected.data(), expected.size(), compressed.data(), compressed.size(), 0) == data.size());
+			CHECK(expected == data);
+
+			std::vector<unsigned char> inflated(data.size() + 1);
+			CHECK(inflateRaw(compressed.data(), compressed.size(), inflated.data(), data.size()));
+			CHECK(memcmp(inflated.data(), data.data(), data.size()) == 0);
+			// the size has to match exactly
+			CHECK(!inflateRaw(compressed.data(), compressed.size(), inflated.data(), data.size() + 1));
+			if (!data.empty()) {
+				CHECK(!inflateRaw(compressed.data(), compressed.size(), inflated.data(), data.size() - 1));
+			}
+		}
+	}
+}
+
+TEST(inflateRawEmpty)
+{
+	checkInflatesLikeMiniz({});
+	checkInflatesLikeMiniz({ 'x' });
+}
+
+TEST(inflateRawRandomBytes)
+{
+	for (size_t size : { 2, 17, 255, 4096, 65535, 65536, 200001 }) {
+		checkInflatesLikeMiniz(randomBytes(size, (unsigned)size));
+	}
+}
+
+TEST(inflateRawText)
+{
+	checkInflatesLikeMiniz(researchText(3));
+	checkInflatesLikeMiniz(researchText(5000));
+}
+
+TEST(inflateRawRuns)
+{
+	// matches longer than their distance and the longest match of 258 bytes
+	checkInflatesLikeMiniz(std::vector<unsigned char>(100000, 'a'));
+	std::vector<unsigned char> pattern;
+	for (size_t i = 0; i < 50000; ++i) {
+		pattern.push_back((unsigned char)"abc"[i % 3]);
+	}
+	checkInflatesLikeMiniz(pattern);
+}
+
+TEST(inflateRawBrokenInput)
+{
+	std::vector<unsigned char> data = researchText(200);
+	std::vector<unsigned char> compressed = deflateWithMiniz(data, 6, MZ_DEFAULT_STRATEGY);
+	std::vector<unsigned char> inflated(data.size());
+	CHECK(!inflateRaw(compressed.data(), compressed.size() / 2, inflated.data(), inflated.size()));
+	CHECK(!inflateRaw(compressed.data(), 0, inflated.data(), inflated.size()));
+
+	// flipped bits must be rejected or inflate to something, never read or write out of bounds
+	std::mt19937 rng(1);
+	for (int i = 0; i < 2000; ++i) {
+		std::vector<unsigned char> broken = compressed;
+		broken[rng() % broken.size()] ^= (unsigned char)(1 << (rng() % 8));
+		inflateRaw(broken.data(), broken.size(), inflated.data(), inflated.size());
+	}
+	// reserved block type 3
+	const unsigned char reserved[] = { 0x07, 0x00 };
+	CHECK(!inflateRaw(reserved, sizeof(reserved), inflated.data(), 1));
+}
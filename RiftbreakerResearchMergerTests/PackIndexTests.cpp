@@ -0,0 +1,221 @@
+#include "Tests.h"
+#include "RBPackIndex.h"
+#include "RBPackReader.h"
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+// folder removed again when the test ends
+class TempFolder
+{
+public:
+	TempFolder() {
+		static std::atomic<unsigned> counter(0);
+		std::random_device random;
+		m_path = std::filesystem::temp_directory_path() / ("RiftbreakerResearchMergerTests." + std::to_string(random()) + "." + std::to_string(counter++));
+		std::filesystem::create_directories(m_path);
+	}
+	~TempFolder() {
+		std::error_code error;
+		std::filesystem::remove_all(m_path, error);
+	}
+	const std::filesystem::path& GetPath() const { return m_path; }
+private:
+	std::filesystem::path m_path;
+};
+
+struct PackFile {
+	std::string name;
+	std::string data;
+	mz_uint level;
+};
+
+static void writePack(const std::filesystem::path& path, const std::vector<PackFile>& files)
+{
+	mz_zip_archive zip;
+	memset(&zip, 0, sizeof(zip));
+	CHECK(mz_zip_writer_init_file(&zip, path.string().c_str(), 0));
+	for (const PackFile& file : files) {
+		CHECK(mz_zip_writer_add_mem(&zip, file.name.c_str(), file.data.data(), file.data.size(), file.level));
+	}
+	CHECK(mz_zip_writer_finalize_archive(&zip));
+	CHECK(mz_zip_writer_end(&zip));
+}
+
+static std::vector<PackFile> packFiles()
+{
+	std::string text;
+	for (int i = 0; i < 20000; ++i) {
+		text += "ResearchNode\n{\n\tresearch_name \"node_" + std::to_string(i) + "\"\n}\n";
+	}
+	std::string bytes(100000, '\0');
+	std::mt19937 rng(1);
+	for (char& byte : bytes) {
+		byte = (char)rng();
+	}
+	return {
+		{ "scripts/research/research_tree.rt", text, MZ_BEST_COMPRESSION },
+		{ "Scripts/Other.rt", text.substr(0, 1000), MZ_NO_COMPRESSION },
+		{ "textures/random.dds", bytes, MZ_DEFAULT_LEVEL },
+		{ "empty.txt", "", MZ_DEFAULT_LEVEL },
+	};
+}
+
+static std::string extract(RBPackReader& pack, const std::string& name)
+{
+	RBBufferPool::Buffer data;
+	CHECK(pack.Extract(name, data));
+	return std::string(data.Data(), data.Size());
+}
+
+// runs check in every I/O mode supported here and restores the mode of the run
+static void forEachMode(const std::function<void()>& check)
+{
+	RBPackReader::Mode previous = RBPackReader::GetMode();
+	for (RBPackReader::Mode mode : { RBPackReader::Mode::STDIO, RBPackReader::Mode::MMAP, RBPackReader::Mode::URING }) {
+		if (RBPackReader::SetMode(mode)) {
+			check();
+		}
+	}
+	RBPackReader::SetMode(previous);
+}
+
+TEST(packIndexSaveLoad)
+{
+	TempFolder folder;
+	std::filesystem::path packPath = folder.GetPath() / "pack.zip";
+	writePack(packPath, packFiles());
+	RBPackReader pack(packPath);
+	auto index = RBPackIndex::Build(pack, "stamp");
+	CHECK(index != nullptr);
+	CHECK(index->GetEntries().size() == packFiles().size());
+
+	std::filesystem::path indexPath = RBPackIndex::GetIndexPath(folder.GetPath() / "cache", packPath);
+	index->Save(indexPath);
+	auto loaded = RBPackIndex::Load(indexPath, "stamp");
+	CHECK(loaded != nullptr);
+	CHECK(loaded->GetEntries().size() == index->GetEntries().size());
+	for (size_t i = 0; i < index->GetEntries().size(); ++i) {
+		const RBPackIndex::Entry& expected = index->GetEntries()[i];
+		const RBPackIndex::Entry& entry = loaded->GetEntries()[i];
+		CHECK(entry.name == expected.name);
+		CHECK(entry.localHeaderOffset == expected.localHeaderOffset);
+		CHECK(entry.compSize == expected.compSize);
+		CHECK(entry.uncompSize == expected.uncompSize);
+		CHECK(entry.crc == expected.crc);
+		CHECK(entry.method == expected.method);
+		CHECK(entry.bitFlag == expected.bitFlag);
+		CHECK(entry.isDirectory == expected.isDirectory);
+	}
+	// names are found ignoring the case like miniz
+	CHECK(loaded->Find("scripts/other.rt") == &loaded->GetEntries()[1]);
+	CHECK(loaded->Find("missing.rt") == nullptr);
+
+	// another stamp of the pack, a missing or a damaged index file
+	CHECK(RBPackIndex::Load(indexPath, "other stamp") == nullptr);
+	CHECK(RBPackIndex::Load(folder.GetPath() / "missing.index", "stamp") == nullptr);
+	std::string data;
+	{
+		std::ifstream instream(indexPath, std::ios::binary);
+		data.assign((std::istreambuf_iterator<char>(instream)), std::istreambuf_iterator<char>());
+	}
+	for (size_t size : { (size_t)0, (size_t)3, data.size() / 2, data.size() - 1 }) {
+		std::ofstream(indexPath, std::ios::binary | std::ios::trunc).write(data.data(), size);
+		CHECK(RBPackIndex::Load(indexPath, "stamp") == nullptr);
+	}
+	std::ofstream(indexPath, std::ios::binary | std::ios::trunc) << data << '\0';
+	CHECK(RBPackIndex::Load(indexPath, "stamp") == nullptr);
+}
+
+TEST(packIndexExtract)
+{
+	TempFolder folder;
+	std::filesystem::path packPath = folder.GetPath() / "pack.zip";
+	std::vector<PackFile> files = packFiles();
+	writePack(packPath, files);
+	forEachMode([&]() {
+		std::shared_ptr<RBPackIndex> index;
+		{
+			RBPackReader pack(packPath);
+			index = RBPackIndex::Build(pack, "stamp");
+			CHECK(index != nullptr);
+		}
+		RBPackReader indexed(packPath, index);
+		RBPackReader plain(packPath);
+		for (const PackFile& file : files) {
+			CHECK(extract(indexed, file.name) == file.data);
+			CHECK(extract(plain, file.name) == file.data);
+		}
+		RBBufferPool::Buffer data;
+		CHECK(!indexed.Extract("missing.rt", data));
+	});
+}
+
+TEST(packIndexStale)
+{
+	// the pack changed after the index was written, entries moved and one was replaced
+	TempFolder folder;
+	std::filesystem::path packPath = folder.GetPath() / "pack.zip";
+	std::vector<PackFile> files = packFiles();
+	writePack(packPath, files);
+	std::shared_ptr<RBPackIndex> index;
+	{
+		RBPackReader pack(packPath);
+		index = RBPackIndex::Build(pack, "stamp");
+		CHECK(index != nullptr);
+	}
+	files.insert(files.begin(), { "readme.txt", "moves every entry", MZ_DEFAULT_LEVEL });
+	files.back().data = "not empty anymore";
+	writePack(packPath, files);
+	forEachMode([&]() {
+		RBPackReader pack(packPath, index);
+		for (size_t i = 1; i < files.size(); ++i) {
+			CHECK(extract(pack, files[i].name) == files[i].data);
+		}
+	});
+}
+
+TEST(packReaderBatchedReads)
+{
+	TempFolder folder;
+	std::vector<PackFile> files = packFiles();
+	std::vector<std::filesystem::path> packPaths;
+	for (int i = 0; i < 3; ++i) {
+		packPaths.push_back(folder.GetPath() / ("pack" + std::to_string(i) + ".zip"));
+		writePack(packPaths.back(), files);
+	}
+	forEachMode([&]() {
+		// with and without an index, which skips reading the central directories
+		for (bool useIndex : { false, true }) {
+			std::vector<std::unique_ptr<RBPackReader>> packs;
+			for (const auto& packPath : packPaths) {
+				std::shared_ptr<RBPackIndex> index;
+				if (useIndex) {
+					RBPackReader pack(packPath);
+					index = RBPackIndex::Build(pack, "stamp");
+				}
+				packs.push_back(std::make_unique<RBPackReader>(packPath, index));
+			}
+			std::vector<RBPackReader*> readers;
+			std::vector<std::pair<RBPackReader*, std::string>> entries;
+			for (const auto& pack : packs) {
+				readers.push_back(pack.get());
+				for (const PackFile& file : files) {
+					entries.emplace_back(pack.get(), file.name);
+				}
+				entries.emplace_back(pack.get(), "missing.rt");
+			}
+			RBPackReader::ReadDirectories(readers);
+			RBPackReader::ReadEntries(entries);
+			for (const auto& pack : packs) {
+				for (const PackFile& file : files) {
+					CHECK(extract(*pack, file.name) == file.data);
+				}
+			}
+		}
+	});
+}
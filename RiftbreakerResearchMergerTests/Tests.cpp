@@ -0,0 +1,39 @@
+#include "Tests.h"
+#include <iostream>
+#include <utility>
+#include <vector>
+
+static std::vector<std::pair<const char*, std::function<void()>>>& testCases()
+{
+	static std::vector<std::pair<const char*, std::function<void()>>> cases;
+	return cases;
+}
+
+TestCase::TestCase(const char* name, std::function<void()> run)
+{
+	testCases().emplace_back(name, std::move(run));
+}
+
+int main(int argc, char** argv)
+{
+	// an argument only runs the tests whose name contains it
+	std::string filter = argc > 1 ? argv[1] : "";
+	size_t failed = 0;
+	size_t run = 0;
+	for (const auto& [name, test] : testCases()) {
+		if (std::string(name).find(filter) == std::string::npos) {
+			continue;
+		}
+		++run;
+		try {
+			test();
+			std::cout << "ok     " << name << std::endl;
+		}
+		catch (const std::exception& e) {
+			++failed;
+			std::cout << "FAILED " << name << ": " << e.what() << std::endl;
+		}
+	}
+	std::cout << run - failed << " of " << run << " tests passed." << std::endl;
+	return failed == 0 ? 0 : -1;
+}
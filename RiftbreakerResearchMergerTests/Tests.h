@@ -0,0 +1,27 @@
+#pragma once
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+// Checks run by RiftbreakerResearchMergerTests. Every TEST registers itself before main,
+// a failed CHECK throws and fails the test it is in.
+class TestCase
+{
+public:
+	TestCase(const char* name, std::function<void()> run);
+};
+
+#define TEST(name) \
+	static void name(); \
+	static TestCase name##Case(#name, name); \
+	static void name()
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::stringstream checkMessage; \
+			checkMessage << __FILE__ << ":" << __LINE__ << ": " << #condition; \
+			throw std::runtime_error(checkMessage.str()); \
+		} \
+	} while (false)